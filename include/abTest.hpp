@@ -0,0 +1,114 @@
+#ifndef SKUNKWORK_ABTEST_HPP
+#define SKUNKWORK_ABTEST_HPP
+
+#include <GL/gl3w.h>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "gpuProfiler.hpp"
+#include "shader.hpp"
+
+// Times two variants of a shader against each other on the gpu
+// Sides are define sets of one shader or two shaders loaded from different files.
+// Once both are compiled they are drawn in ABBA order at a fixed time so drift
+// hits both equally, each frame timed with its own query. The mean difference is
+// reported with a 95% confidence interval and one frame of each side is compared
+// to catch changes in the output.
+class ABTest
+{
+public:
+    // Frames drawn before samples are kept, drivers finish some compiles on first use
+    static constexpr uint32_t WARMUP_FRAMES = 16;
+
+    struct Side {
+        Shader* shader;
+        Shader::Defines defines;
+    };
+
+    struct Result {
+        uint32_t samplesA = 0;
+        uint32_t samplesB = 0;
+        float meanA = 0.f;
+        float meanB = 0.f;
+        // B minus A in milliseconds
+        float difference = 0.f;
+        float confidence95 = 0.f;
+        // Over 8-bit rgb, -1 if the images couldn't be compared
+        float rmse = -1.f;
+        uint32_t maxDifference = 0;
+        float differingPixels = 0.f;
+    };
+
+    static ABTest& instance();
+
+    ABTest(const ABTest&) = delete;
+    ABTest& operator=(const ABTest&) = delete;
+
+    // Queries are created on the first test, release them before the context is destroyed
+    void destroy();
+    // Shader the GUI tests define toggles on
+    void setShader(Shader& shader);
+    Shader* shader() const;
+
+    void start(const Side& a, const Side& b, float time, uint32_t samples = 400);
+    // Restores the defines side A had
+    void stop();
+    bool running() const;
+    // Fixed time the sides are drawn at
+    float time() const;
+    // Picks this frame's side and starts timing it, the returned shader should be bound
+    // and drawn before endFrame
+    Shader& startFrame();
+    // Call right after the draw, before anything is drawn on top of it
+    void endFrame(uint32_t width, uint32_t height);
+
+    const std::string& status() const;
+    bool hasResult() const;
+    const Result& result() const;
+
+private:
+    enum class Phase {
+        Idle,
+        Compile,
+        Sample,
+        CaptureA,
+        CaptureB
+    };
+
+    struct Query {
+        GLuint id = 0;
+        // Side index, -1 if nothing is pending
+        int32_t side = -1;
+    };
+
+    ABTest();
+    ~ABTest() { }
+
+    void collect();
+    void finish();
+    void setStatus(const char* fmt, ...);
+
+    bool                                              _initialized;
+    Shader*                                           _shader;
+    std::array<Side, 2>                               _sides;
+    Phase                                             _phase;
+    float                                             _time;
+    uint32_t                                          _samples;
+    uint64_t                                          _frame;
+    // Set while this frame's query is open
+    bool                                              _timing;
+    std::array<Query, GpuProfiler::FRAME_LATENCY>     _queries;
+    std::array<std::vector<float>, 2>                 _times;
+    std::array<std::vector<uint8_t>, 2>               _images;
+    std::array<uint32_t, 2>                           _imageWidths;
+    std::array<uint32_t, 2>                           _imageHeights;
+    uint32_t                                          _dropped;
+    std::string                                       _status;
+    bool                                              _hasResult;
+    Result                                            _result;
+
+};
+
+#endif // SKUNKWORK_ABTEST_HPP
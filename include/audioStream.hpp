@@ -29,6 +29,8 @@ public:
     void pause();
     void stop();
     double getRow() const;
+    // Row at a time in seconds, for rendering without playback
+    double timeToRow(double seconds) const;
     void setRow(int32_t row);
 
 private:
@@ -0,0 +1,16 @@
+#ifndef SKUNKWORK_COMMANDLINE_HPP
+#define SKUNKWORK_COMMANDLINE_HPP
+
+#include "exporter.hpp"
+#include "window.hpp"
+
+// Options shared by both executables
+struct CommandLine {
+    Window::Config window;
+    Exporter::Config exporter;
+
+    // Returns false and prints usage on unknown or invalid arguments
+    bool parse(int argc, char* argv[]);
+};
+
+#endif // SKUNKWORK_COMMANDLINE_HPP
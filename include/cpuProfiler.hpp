@@ -0,0 +1,127 @@
+#ifndef SKUNKWORK_CPUPROFILER_HPP
+#define SKUNKWORK_CPUPROFILER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "spscQueue.hpp"
+#include "timeHistory.hpp"
+#include "timer.hpp"
+
+// Times named scopes on any thread against a steady clock
+// Every thread records finished scopes into its own lock-free ring that the main
+// thread drains once a frame. Nesting is rebuilt from the intervals so recording
+// is a clock read at each end and a push. When disabled a scope is a relaxed load.
+class CpuProfiler
+{
+public:
+    static constexpr size_t RING_SIZE = 1024;
+
+    struct Scope {
+        std::string name;
+        uint32_t thread;
+        // Index of the enclosing scope or -1
+        int32_t parent;
+        uint32_t depth;
+        TimeHistory times;
+    };
+
+    static CpuProfiler& instance();
+
+    CpuProfiler(const CpuProfiler&) = delete;
+    CpuProfiler& operator=(const CpuProfiler&) = delete;
+
+    void setEnabled(bool enabled);
+    bool enabled() const { return _enabled.load(std::memory_order_relaxed); }
+    // Names the calling thread in the results
+    void setThreadName(const std::string& name);
+
+    // Collects the scopes threads have finished since the last call
+    // Should be called from one thread only, outside any scope
+    void startFrame();
+    const std::vector<Scope>& scopes() const;
+    // Scope indices grouped by thread with children right after their parent
+    const std::vector<uint32_t>& displayOrder() const;
+    uint32_t threadCount() const;
+    const std::string& threadName(uint32_t thread) const;
+    // Average of the root scope with the given name on any thread
+    float average(const std::string& name, uint32_t frames = 5) const;
+    uint32_t droppedScopes() const;
+
+    uint64_t now() const { return _clock.getNanoseconds(); }
+    // Name has to outlive the profiler, string literals in practice
+    void record(const char* name, uint64_t start, uint64_t end);
+
+private:
+    struct Event {
+        const char* name;
+        uint64_t start;
+        uint64_t end;
+    };
+
+    struct ThreadEvents {
+        std::string name;
+        SpscQueue<Event, RING_SIZE> events;
+        std::atomic<uint32_t> dropped;
+    };
+
+    CpuProfiler();
+    ~CpuProfiler() { }
+
+    ThreadEvents& threadEvents();
+    uint32_t scopeIndex(uint32_t thread, int32_t parent, const char* name);
+    void updateDisplayOrder();
+
+    Timer                                      _clock;
+    std::atomic<bool>                          _enabled;
+    // Guards registration, threads only take it once
+    std::mutex                                 _mutex;
+    // Rings outlive their threads so scopes keep their thread index. That's bounded
+    // as only the main thread, compiler workers started once and export writers
+    // record scopes, about RING_SIZE events each.
+    std::vector<std::unique_ptr<ThreadEvents>> _threads;
+    // Consumer side
+    std::vector<Event>                         _frameEvents;
+    std::vector<std::string>                   _threadNames;
+    std::vector<Scope>                         _scopes;
+    std::map<std::tuple<uint32_t, int32_t, std::string>, uint32_t> _scopeIndices;
+    std::vector<uint32_t>                      _displayOrder;
+    uint32_t                                   _dropped;
+
+};
+
+// Records the time between construction and destruction as a scope
+class CpuScope
+{
+public:
+    explicit CpuScope(const char* name)
+    {
+        CpuProfiler& profiler = CpuProfiler::instance();
+        _name = profiler.enabled() ? name : nullptr;
+        _start = _name != nullptr ? profiler.now() : 0;
+    }
+
+    ~CpuScope()
+    {
+        if (_name != nullptr) {
+            CpuProfiler& profiler = CpuProfiler::instance();
+            profiler.record(_name, _start, profiler.now());
+        }
+    }
+
+    CpuScope(const CpuScope&) = delete;
+    CpuScope& operator=(const CpuScope&) = delete;
+
+private:
+    const char* _name;
+    uint64_t    _start;
+
+};
+
+#endif // SKUNKWORK_CPUPROFILER_HPP
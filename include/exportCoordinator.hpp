@@ -0,0 +1,71 @@
+#ifndef SKUNKWORK_EXPORTCOORDINATOR_HPP
+#define SKUNKWORK_EXPORTCOORDINATOR_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "commandLine.hpp"
+
+// Splits an export over local worker processes, each with its own context
+// The range is cut into chunks that idle workers pick up in order, so slow parts
+// of the demo don't hold up a whole stride. Workers are copies of this executable
+// exporting one chunk each. Failed chunks are retried, streams are assembled from
+// the finished parts in frame order while the rest are still rendering and png
+// frames are written in place by the workers. Runs before any window or context
+// is created, so messages go to stderr. Only supported on POSIX systems.
+class ExportCoordinator
+{
+public:
+    static constexpr uint32_t MAX_ATTEMPTS = 3;
+    // Chunks per worker when no size is given, smaller ones balance better
+    static constexpr uint32_t CHUNKS_PER_WORKER = 4;
+
+    ExportCoordinator(const CommandLine& options, const char* executable);
+
+    ExportCoordinator(const ExportCoordinator& other) = delete;
+    ExportCoordinator operator=(const ExportCoordinator& other) = delete;
+
+    // Returns true if every frame was written
+    bool run();
+
+private:
+    enum class State {
+        Waiting,
+        Running,
+        Done,
+        Failed
+    };
+
+    struct Chunk {
+        uint32_t first;
+        uint32_t end;
+        State state;
+        uint32_t attempts;
+        int pid;
+    };
+
+    bool launch(Chunk& chunk);
+    // Polls running workers, returns false if none are left
+    bool collect();
+    // Appends finished parts to the output in order
+    bool assemble();
+    std::string partPath(const Chunk& chunk) const;
+    std::string logPath(const Chunk& chunk) const;
+
+    CommandLine         _options;
+    std::string         _executable;
+    std::string         _partDirectory;
+    std::vector<Chunk>  _chunks;
+    size_t              _nextAssembled;
+    uint32_t            _running;
+    uint32_t            _retries;
+    FILE*               _output;
+    bool                _pipe;
+    // Stops launching workers and kills running ones
+    bool                _failed;
+
+};
+
+#endif // SKUNKWORK_EXPORTCOORDINATOR_HPP
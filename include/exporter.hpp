@@ -0,0 +1,139 @@
+#ifndef SKUNKWORK_EXPORTER_HPP
+#define SKUNKWORK_EXPORTER_HPP
+
+#include <GL/gl3w.h>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frameBuffer.hpp"
+
+// Renders a range of frames at a fixed time step for video captures
+// Time advances by 1 / fps per frame regardless of how long frames take, so
+// exports don't drop frames and come out the same on every run. Frames are
+// drawn into an offscreen target of any size and read back through a ring of
+// pixel pack buffers: the read of frame N is only mapped after frames N + 1 and
+// N + 2 have been issued. Encoding runs on a pool of writer threads and the
+// render thread only waits on them when all frame buffers are queued.
+// Everything but the writers runs on the main thread.
+class Exporter
+{
+public:
+    enum class Format {
+        // Numbered files in a directory, stored without compression
+        Png,
+        // 4:2:0 video stream, e.g. for piping to ffmpeg
+        Y4m,
+        // Bare rgba rows, top to bottom
+        Raw
+    };
+
+    struct Config {
+        // Directory for png, a file, - for stdout or |command to pipe to for streams
+        std::string path;
+        Format format = Format::Png;
+        int width = 0;
+        int height = 0;
+        double fps = 60.0;
+        // Frames [first, end) are rendered, numbering and time start from frame 0
+        uint32_t first = 0;
+        uint32_t end = 0;
+        // Splits the range over this many processes if above 1
+        uint32_t workers = 1;
+        // Frames per job handed to a worker process, picked from the range if 0
+        uint32_t chunkSize = 0;
+
+        bool enabled() const;
+    };
+
+    static constexpr uint32_t RING_SIZE = 3;
+    static constexpr uint32_t MAX_WRITERS = 8;
+
+    static Exporter& instance();
+
+    // Opens a file, stdout for - or a pipe to a command for |command
+    static FILE* openStream(const std::string& path, bool& pipe);
+    // Returns false if buffered data couldn't be written or a piped command failed
+    static bool closeStream(FILE* stream, bool pipe);
+
+    Exporter(const Exporter&) = delete;
+    Exporter& operator=(const Exporter&) = delete;
+
+    bool start(const Config& config);
+    // Writes out frames still in flight, called by endFrame after the last one
+    void stop();
+    bool running() const;
+    // All frames of the range were rendered or the export failed
+    bool finished() const;
+    // All frames of the range were written
+    bool complete() const;
+
+    // Time and size of the frame being rendered
+    double time() const;
+    uint32_t frame() const;
+    int width() const;
+    int height() const;
+
+    // Binds and clears the target
+    void startFrame();
+    // Reads the frame back and shows it scaled to the window's framebuffer
+    void endFrame(int windowWidth, int windowHeight);
+
+private:
+    struct Image {
+        uint32_t frame;
+        std::vector<uint8_t> pixels;
+        // Reused between frames by the writers
+        std::vector<uint8_t> encoded;
+    };
+
+    Exporter();
+    ~Exporter() { }
+
+    bool openOutput();
+    void closeOutput();
+    void retire();
+    void run();
+    bool encode(Image& image) const;
+    void fail(const std::string& error);
+
+    Config                                  _config;
+    bool                                    _running;
+    bool                                    _finished;
+    uint32_t                                _frame;
+    std::unique_ptr<FrameBuffer>            _target;
+    std::array<GLuint, RING_SIZE>           _pbos;
+    std::array<GLsync, RING_SIZE>           _fences;
+    std::array<uint32_t, RING_SIZE>         _ringFrames;
+    // Oldest read in flight and count of reads
+    uint32_t                                _ringStart;
+    uint32_t                                _ringCount;
+    uint32_t                                _readStalls;
+    uint32_t                                _writerStalls;
+    uint64_t                                _startNs;
+    FILE*                                   _output;
+    bool                                    _pipe;
+    // Writer side
+    std::vector<std::thread>                _writers;
+    std::mutex                              _mutex;
+    std::condition_variable                 _cond;
+    std::deque<std::unique_ptr<Image>>      _queue;
+    std::vector<std::unique_ptr<Image>>     _free;
+    size_t                                  _imageCount;
+    // Streams are written in frame order
+    uint32_t                                _nextWrite;
+    bool                                    _stopping;
+    std::atomic<bool>                       _failed;
+    std::string                             _error;
+
+};
+
+#endif // SKUNKWORK_EXPORTER_HPP
@@ -0,0 +1,14 @@
+#ifndef SKUNKWORK_FILESYSTEM_HPP
+#define SKUNKWORK_FILESYSTEM_HPP
+
+#include <string>
+
+// Creates a single directory, existing ones are left alone
+void makeDir(const std::string& path);
+// Path next to the given one that only this process writes to
+std::string tempPath(const std::string& path);
+// Moves the file over the destination, replacing it in one step where the system allows
+// Returns false and removes the source if it couldn't be moved
+bool replaceFile(const std::string& from, const std::string& to);
+
+#endif // SKUNKWORK_FILESYSTEM_HPP
@@ -0,0 +1,59 @@
+#ifndef SKUNKWORK_FILEWATCHER_HPP
+#define SKUNKWORK_FILEWATCHER_HPP
+
+#include <atomic>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#ifndef __linux__
+#include <condition_variable>
+#endif // __linux__
+
+#include "spscQueue.hpp"
+
+// Watches source files on a background thread. Uses inotify on linux and falls
+// back to polling file timestamps elsewhere. Changes are handed to the render
+// thread through a lock-free queue so checking for them is practically free.
+class FileWatcher
+{
+public:
+    static FileWatcher& instance();
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    // Start watching the file, watching the same path again is a no-op
+    void watch(const std::string& path);
+    // Replaces contents of changedPaths with the paths modified since last call
+    // Paths are reported as they were given to watch()
+    // Returns false without touching changedPaths if nothing changed
+    bool poll(std::vector<std::string>& changedPaths);
+
+private:
+    FileWatcher();
+    ~FileWatcher();
+
+    void run();
+
+    std::thread                 _thread;
+    std::atomic<bool>           _running;
+    std::mutex                  _watchMutex;
+    SpscQueue<std::string, 256> _changes;
+#ifdef __linux__
+    int                         _inotifyFD;
+    int                         _wakeFDs[2];
+    // Watch descriptor -> canonical directory path
+    std::unordered_map<int, std::string> _watchDirs;
+    // Canonical file path -> paths given to watch()
+    std::unordered_map<std::string, std::vector<std::string>> _watchFiles;
+#else
+    std::condition_variable     _wakeCond;
+    std::unordered_map<std::string, time_t> _fileMods;
+#endif // __linux__
+
+};
+
+#endif // SKUNKWORK_FILEWATCHER_HPP
@@ -18,10 +18,17 @@ public:
     FrameBuffer operator=(const FrameBuffer& other) = delete;
 
     void bindWrite();
+    // Makes the attachment the source of glReadPixels and blits
+    void bindReadBuffer(uint32_t texNum);
     void bindRead(uint32_t texNum, GLenum texUnit, GLint uniforms);
     void genMipmap(uint32_t texNum);
     void resize(uint32_t w, uint32_t h);
 
+    // Binds the window's framebuffer, which is an offscreen one when headless
+    // Use instead of binding 0
+    static void bindDefault(GLenum target = GL_FRAMEBUFFER);
+    static void setDefault(const FrameBuffer* frameBuffer);
+
 private:
     GLuint                      _fbo;
     std::vector<GLuint>         _texIDs;
@@ -0,0 +1,70 @@
+#ifndef SKUNKWORK_FRAMESTATS_HPP
+#define SKUNKWORK_FRAMESTATS_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "timeHistory.hpp"
+#include "timer.hpp"
+
+// Several seconds of cpu and gpu frame times for spotting spikes averages hide
+// Cpu frames are the time between endFrame calls, gpu frames the sum of root
+// scopes GpuProfiler reads back a few frames later. Cpu frames over the budget
+// are logged as hitches with their sync row to find them in the Rocket timeline,
+// at most one line a second with a count of the ones in between.
+class FrameStats
+{
+public:
+    // A bit over 15 seconds at 60 fps
+    static constexpr uint32_t HISTORY = 1024;
+    static constexpr float HITCH_LOG_INTERVAL_S = 1.f;
+    using History = TimeRing<HISTORY>;
+
+    struct Summary {
+        float p50 = 0.f;
+        float p95 = 0.f;
+        float p99 = 0.f;
+        float max = 0.f;
+    };
+
+    static FrameStats& instance();
+
+    FrameStats(const FrameStats&) = delete;
+    FrameStats& operator=(const FrameStats&) = delete;
+
+    // Call once a frame, rows below zero aren't logged
+    void endFrame(double syncRow = -1.0);
+    void addGpuFrame(float ms);
+
+    void setBudget(float ms);
+    // Hitches are still counted when not logged, e.g. for offline or software rendering
+    void setLogHitches(bool log);
+    float budget() const;
+    uint32_t hitches() const;
+
+    const History& cpuTimes() const;
+    const History& gpuTimes() const;
+    static Summary summarize(const History& times);
+    // Counts of times in equal bins up to maxMs, the last bin also gets the ones over
+    static void histogram(const History& times, float maxMs, std::vector<float>& bins);
+
+private:
+    FrameStats();
+    ~FrameStats() { }
+
+    Timer    _timer;
+    bool     _started;
+    uint64_t _frame;
+    float    _budget;
+    uint32_t _hitches;
+    bool     _logHitches;
+    Timer    _hitchLogTimer;
+    bool     _hitchLogged;
+    // Hitches since the last logged one
+    uint32_t _unloggedHitches;
+    History  _cpu;
+    History  _gpu;
+
+};
+
+#endif // SKUNKWORK_FRAMESTATS_HPP
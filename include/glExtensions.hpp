@@ -0,0 +1,8 @@
+#ifndef SKUNKWORK_GLEXTENSIONS_HPP
+#define SKUNKWORK_GLEXTENSIONS_HPP
+
+// Queries against the current context
+bool hasGLExtension(const char* name);
+bool hasGLVersion(int major, int minor);
+
+#endif // SKUNKWORK_GLEXTENSIONS_HPP
@@ -2,22 +2,131 @@
 #define GPUPROFILER_HPP
 
 #include <GL/gl3w.h>
+#include <array>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "timeHistory.hpp"
+
+// Times named scopes on the gpu without stalling the cpu
+// Each frame records its queries into its own pool in a ring of FRAME_LATENCY
+// pools. Results are only read once the driver reports them available, frames
+// still not done when their pool comes around again are dropped instead.
+// Scopes nest through GL_TIMESTAMP counters. Where the counter isn't supported
+// (OSX) elapsed queries are used and only the outermost scopes get timed.
+// Pipeline statistics are optional and collected for the outermost scopes.
 class GpuProfiler
 {
 public:
-    GpuProfiler(uint32_t window);
-    ~GpuProfiler() {}
+    static constexpr uint32_t FRAME_LATENCY = 4;
+    static constexpr uint32_t MAX_SCOPES = 32;
+    // Clocks are re-synced this often while a trace is recorded
+    static constexpr uint32_t CALIBRATION_INTERVAL = 60;
+
+    struct PipelineStats {
+        uint64_t fragments = 0;
+        uint64_t primitives = 0;
+        uint64_t samples = 0;
+    };
+
+    struct Scope {
+        std::string name;
+        // Nesting level when the scope was first seen
+        uint32_t depth;
+        TimeHistory times;
+        // Latest counters if the scope has been collected with them
+        bool hasStats = false;
+        PipelineStats stats;
+    };
+
+    static GpuProfiler& instance();
+
+    GpuProfiler(const GpuProfiler&) = delete;
+    GpuProfiler& operator=(const GpuProfiler&) = delete;
 
-    void startSample();
-    void endSample();
-    float getAvg() const;
+    // Queries are created on the first frame, release them before the context is destroyed
+    void destroy();
+    // Collects finished frames, scopes should only be opened between these
+    void startFrame();
+    void endFrame();
+    void begin(const std::string& name);
+    void end();
+
+    // In the order they were first seen
+    const std::vector<Scope>& scopes() const;
+    // Average of the latest frames, zero if the scope hasn't been timed
+    float average(const std::string& name, uint32_t frames = 5) const;
+    // Frames whose results weren't ready in time
+    uint32_t droppedFrames() const;
+    // Counts fragment shader invocations, submitted primitives and passed samples
+    // Takes effect on the next scopes
+    void setPipelineStats(bool enabled);
+    bool pipelineStats() const;
+    // Only samples passed is counted without ARB_pipeline_statistics_query
+    bool fullPipelineStats() const;
 
 private:
-    GLuint             _queryIDs[2];
-    bool               _backActive;
-    std::vector<float> _times;
+    // Fragments, primitives and samples
+    static constexpr uint32_t STAT_TARGETS = 3;
+
+    struct Sample {
+        uint32_t scope;
+        // Untimed if the counter isn't supported and another scope was open
+        bool timed;
+        // Root scopes add up to the frame's gpu time
+        bool root;
+        bool stats;
+    };
+
+    struct Frame {
+        std::array<GLuint, 2 * MAX_SCOPES> queries;
+        std::array<GLuint, STAT_TARGETS * MAX_SCOPES> statQueries;
+        std::vector<Sample> samples;
+        // Anchors the intervals in traces when there are no timestamps
+        uint64_t cpuStart = 0;
+        bool pending = false;
+    };
+
+    GpuProfiler();
+    ~GpuProfiler() { }
+
+    void init();
+    void calibrate();
+    // Returns false if the results aren't available yet
+    bool collect(Frame& frame);
+
+    bool                                        _initialized;
+    bool                                        _timestamps;
+    std::array<Frame, FRAME_LATENCY>            _frames;
+    uint64_t                                    _frameIndex;
+    bool                                        _inFrame;
+    // Samples of open scopes, -1 for ones that were dropped
+    std::vector<int32_t>                        _stack;
+    std::vector<Scope>                          _scopes;
+    std::unordered_map<std::string, uint32_t>   _scopeIndices;
+    uint32_t                                    _dropped;
+    // Zero for counters that aren't supported
+    std::array<GLenum, STAT_TARGETS>            _statTargets;
+    bool                                        _pipelineStats;
+    // Statistics queries can't nest
+    bool                                        _statsOpen;
+    // Gpu timestamp minus cpu profiler time
+    int64_t                                     _clockOffset;
+    bool                                        _calibrated;
+    uint64_t                                    _calibrationFrame;
+
+};
+
+// Times its lifetime on the gpu
+class GpuScope
+{
+public:
+    GpuScope(const std::string& name) { GpuProfiler::instance().begin(name); }
+    ~GpuScope() { GpuProfiler::instance().end(); }
+
+    GpuScope(const GpuScope&) = delete;
+    GpuScope& operator=(const GpuScope&) = delete;
 
 };
 
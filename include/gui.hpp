@@ -8,6 +8,7 @@
 #include <utility>
 #include <vector>
 
+#include "cpuProfiler.hpp"
 #include "gpuProfiler.hpp"
 #include "shader.hpp"
 
@@ -16,19 +17,32 @@ class GUI
 public:
     GUI();
 
+    // Input isn't hooked up without a window
     void init(GLFWwindow* window);
     void destroy();
     bool useSliderTime() const;
     float sliderTime() const;
+    bool freezeUniforms() const;
+    bool heatmap() const;
 
-    void startFrame(int windowHeight,
-                    std::unordered_map<std::string, Uniform>& uniforms,
-                    const std::vector<std::pair<std::string, const GpuProfiler*>>& timers);
+    void startFrame(int windowHeight, std::unordered_map<std::string, Uniform>& uniforms);
     void endFrame();
 
 private:
+    void frameStats();
+    // Gpu and per thread cpu scopes as trees
+    void profiler();
+    void abTest();
+
+    GLFWwindow* _window;
     bool _useSliderTime;
     float _sliderTime;
+    bool _freezeUniforms;
+    bool _heatmap;
+    // Define toggled for side B as "NAME" or "NAME VALUE"
+    char _abDefine[64];
+    float _abTime;
+    int _abSamples;
 };
 
 #endif // SKUNKWORK_GUI_HPP
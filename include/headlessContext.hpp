@@ -0,0 +1,51 @@
+#ifndef SKUNKWORK_HEADLESSCONTEXT_HPP
+#define SKUNKWORK_HEADLESSCONTEXT_HPP
+
+// GL context without a window or display server, created through EGL
+// Uses the first EGL device or Mesa's surfaceless platform, so it also works on
+// llvmpipe. Contexts are made current without a surface if the driver allows it,
+// on a tiny pbuffer otherwise, rendering is expected to go to framebuffer objects.
+// Only available when built with SKUNKWORK_EGL.
+class HeadlessContext
+{
+public:
+    // Worker context sharing objects with the main one
+    struct Shared {
+        void* context = nullptr;
+        // Only used without surfaceless support
+        void* surface = nullptr;
+    };
+
+    HeadlessContext();
+    ~HeadlessContext() { }
+
+    HeadlessContext(const HeadlessContext& other) = delete;
+    HeadlessContext(HeadlessContext&& other);
+    HeadlessContext operator=(const HeadlessContext& other) = delete;
+
+    // Creates a core profile context of at least the given version and makes it current
+    bool init(int major, int minor);
+    void destroy();
+
+    Shared createShared() const;
+    void destroyShared(Shared& shared) const;
+    bool makeCurrent(const Shared& shared) const;
+    void releaseCurrent() const;
+    bool surfaceless() const;
+
+private:
+    void* createContext(void* share) const;
+    void* createSurface() const;
+
+    int   _major;
+    int   _minor;
+    // EGL handles are pointers, kept opaque here so users don't need EGL headers
+    void* _display;
+    void* _config;
+    void* _context;
+    void* _surface;
+    bool  _surfaceless;
+
+};
+
+#endif // SKUNKWORK_HEADLESSCONTEXT_HPP
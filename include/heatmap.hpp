@@ -0,0 +1,88 @@
+#ifndef SKUNKWORK_HEATMAP_HPP
+#define SKUNKWORK_HEATMAP_HPP
+
+#include <GL/gl3w.h>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "frameBuffer.hpp"
+#include "quad.hpp"
+#include "shaderSource.hpp"
+
+// Per-pixel cost of raymarched scenes as a false color overlay
+// Shaders compiled with DEFINE count the iterations of every loop in the fragment
+// stage and write the count to a second attachment of the heatmap's target. The
+// counts are read back through a fenced pixel buffer so the stats lag a frame or
+// two instead of stalling. The scene's color output should be declared with
+// location 0. Only loops with braced bodies are counted, shaders without any, like
+// the default scene, show no heat.
+class Heatmap
+{
+public:
+    static constexpr const char* DEFINE = "SKUNKWORK_HEATMAP";
+    static constexpr uint32_t TILE_SIZE = 32;
+    static constexpr size_t HOTTEST_TILES = 5;
+
+    struct Tile {
+        // In tiles from the bottom left
+        uint32_t x;
+        uint32_t y;
+        float average;
+    };
+
+    struct Stats {
+        uint64_t totalSteps = 0;
+        float average = 0.f;
+        uint32_t max = 0;
+        // Highest average first
+        std::vector<Tile> hottest;
+    };
+
+    static Heatmap& instance();
+
+    Heatmap(const Heatmap&) = delete;
+    Heatmap& operator=(const Heatmap&) = delete;
+
+    // Counts loop iterations in a fragment stage source
+    // Loops whose body starts with a brace are counted, returns how many were found
+    static size_t instrument(ShaderSource& source);
+
+    // Resources are created on the first frame, release them before the context is destroyed
+    void destroy();
+    // Redirects rendering to the heatmap's target, sized to the window
+    void begin(uint32_t width, uint32_t height);
+    // Draws the scene with the heat overlaid to the window and reads the counts back
+    void end(const Quad& quad);
+
+    // Steps that map to the hottest color
+    void setScale(float steps);
+    float scale() const;
+    const Stats& stats() const;
+
+private:
+    Heatmap();
+    ~Heatmap() { }
+
+    void init();
+    void startReadback();
+    void finishReadback();
+
+    bool                         _initialized;
+    std::unique_ptr<FrameBuffer> _target;
+    uint32_t                     _width;
+    uint32_t                     _height;
+    GLuint                       _program;
+    GLint                        _sceneLocation;
+    GLint                        _stepsLocation;
+    GLint                        _scaleLocation;
+    float                        _scale;
+    GLuint                       _pbo;
+    GLsync                       _fence;
+    uint32_t                     _readWidth;
+    uint32_t                     _readHeight;
+    Stats                        _stats;
+
+};
+
+#endif // SKUNKWORK_HEATMAP_HPP
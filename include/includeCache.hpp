@@ -0,0 +1,55 @@
+#ifndef SKUNKWORK_INCLUDECACHE_HPP
+#define SKUNKWORK_INCLUDECACHE_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "shaderSource.hpp"
+
+// Parsed shader files shared by every program and stage that uses them
+// Entries are keyed by canonical path and revalidated against the file's
+// modification time, size and inode, so unchanged files are never read twice.
+// Only used from the render thread.
+class IncludeCache
+{
+public:
+    static IncludeCache& instance();
+
+    IncludeCache(const IncludeCache&) = delete;
+    IncludeCache& operator=(const IncludeCache&) = delete;
+
+    // Returns nullptr if the file can't be opened
+    std::shared_ptr<const SourceFile> get(const std::string& path);
+    // Logs and resets the hit and miss counts since last report
+    void report();
+
+private:
+    struct Stamp {
+        int64_t mtime;
+        int64_t size;
+        uint64_t inode;
+
+        bool operator==(const Stamp& other) const {
+            return mtime == other.mtime && size == other.size && inode == other.inode;
+        }
+    };
+
+    struct Entry {
+        Stamp stamp;
+        std::shared_ptr<const SourceFile> file;
+    };
+
+    IncludeCache();
+    ~IncludeCache() { }
+
+    std::shared_ptr<const SourceFile> parse(const std::string& path) const;
+
+    std::unordered_map<std::string, Entry>  _entries;
+    uint32_t                                _hits;
+    uint32_t                                _misses;
+
+};
+
+#endif // SKUNKWORK_INCLUDECACHE_HPP
@@ -42,6 +42,9 @@ public:
     Log& operator=(const Log&) = delete;
 
     void addLog(const char* fmt, ...) IM_FMTARGS(2);
+    // Also prints messages to stderr, for runs without the log window
+    // Stdout is left free for exported streams
+    void setEcho(bool echo);
 
 private:
     Log();
@@ -54,6 +57,7 @@ private:
     ImGuiTextFilter _filter;
     ImVector<int> _lineOffsets;
     bool _scrollToBottom;
+    bool _echo;
 };
 
 // Interface for GUI to enforce both the singleton as well as only GUI being able
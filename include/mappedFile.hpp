@@ -0,0 +1,36 @@
+#ifndef SKUNKWORK_MAPPEDFILE_HPP
+#define SKUNKWORK_MAPPEDFILE_HPP
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Read-only memory mapping of a whole file
+// The view stays valid when the object is moved
+class MappedFile
+{
+public:
+    MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile& other) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile operator=(const MappedFile& other) = delete;
+
+    bool isOpen() const;
+    std::string_view view() const;
+
+private:
+    void unmap();
+
+    const char* _data;
+    size_t      _size;
+    bool        _open;
+#ifdef _WIN32
+    void*       _file;
+    void*       _mapping;
+#endif // _WIN32
+
+};
+
+#endif // SKUNKWORK_MAPPEDFILE_HPP
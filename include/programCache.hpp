@@ -0,0 +1,41 @@
+#ifndef SKUNKWORK_PROGRAMCACHE_HPP
+#define SKUNKWORK_PROGRAMCACHE_HPP
+
+#include <GL/gl3w.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "shaderSource.hpp"
+
+// On-disk cache of linked program binaries
+// Entries are keyed by the preprocessed stage sources and the driver they were built with
+class ProgramCache
+{
+public:
+    static ProgramCache& instance();
+
+    ProgramCache(const ProgramCache&) = delete;
+    ProgramCache& operator=(const ProgramCache&) = delete;
+
+    uint64_t key(const std::vector<const ShaderSource*>& sources) const;
+    // Returns a linked program or 0 if the binary is missing or was rejected
+    GLuint load(uint64_t key);
+    // Program should be linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set
+    void store(uint64_t key, GLuint program);
+
+private:
+    ProgramCache();
+    ~ProgramCache() { }
+
+    std::string path(uint64_t key) const;
+
+    bool        _supported;
+    std::string _driver;
+    std::string _dirPath;
+    uint32_t    _hits;
+    uint32_t    _misses;
+
+};
+
+#endif // SKUNKWORK_PROGRAMCACHE_HPP
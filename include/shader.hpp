@@ -2,6 +2,10 @@
 #define SKUNKWORK_SHADER_HPP
 
 #include <GL/gl3w.h>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -10,26 +14,62 @@
 #include <sync.h>
 #endif // ROCKET
 
-enum class UniformType {
-    Float,
-    Vec2,
-    Vec3
-};
-
-struct Uniform {
-    UniformType type;
-    float value[3];
-};
+#include "shaderCompiler.hpp"
+#include "shaderSource.hpp"
+#include "spirvCompiler.hpp"
+#include "timer.hpp"
+#include "uniform.hpp"
+#include "uniformBuffer.hpp"
 
 class Shader
 {
-    enum class Vendor {
-        Nvidia,
-        Intel,
-        NotSupported
+    struct UniformSlot {
+        std::string name;
+        UniformType type;
+        GLint location;
+    };
+
+    // Uniforms in the Params block are written at offset instead of location
+    // Shadow holds the value last set to the program to skip redundant uploads
+    struct DynamicBinding {
+        GLint location;
+        GLint offset;
+        const Uniform* uniform;
+        bool valid;
+        float shadow[3];
+    };
+
+#ifdef ROCKET
+    struct RocketBinding {
+        GLint location;
+        GLint offset;
+        const sync_track* track;
+        bool valid;
+        GLfloat shadow;
+    };
+#endif // ROCKET
+
+    // Program compiled with a set of defines
+    struct Variant {
+        std::map<std::string, std::string> defines;
+        GLuint program;
+        // Set if the program was built from SPIR-V
+        std::shared_ptr<const SpirvReflection> reflection;
+        // Built from sources that have since changed, only kept bound until replaced
+        bool stale;
     };
 
 public:
+    // Name -> value injected as #defines after #version in every stage
+    using Defines = std::map<std::string, std::string>;
+
+    // Compiled variants kept around for switching without recompiling
+    static constexpr size_t MAX_VARIANTS = 8;
+
+    // d* and r* uniforms declared inside a "Params" block get packed into a
+    // per-shader uniform buffer at this binding, shared blocks should use others
+    static constexpr GLuint PARAMS_BINDING = 1;
+
 #ifdef ROCKET
     Shader(const std::string& name, sync_device* rocket, const std::string& vertPath,
            const std::string& fragPath, const std::string& geomPath = "");
@@ -49,37 +89,103 @@ public:
 #else
     void bind();
 #endif // ROCKET
-    bool reload();
+    // Starts reloading the program from its current sources
+    void reload();
+    // Swaps in the reloaded program when it has finished compiling, call once per frame
+    void update();
+    bool pending() const;
+    // True once a program has been linked, stays false while the first load fails
+    bool linked() const;
+    // Switches to the program compiled with defines, compiling it in the background
+    // if it isn't cached. The current variant stays bound until then.
+    void setDefines(const Defines& defines);
+    const Defines& defines() const;
+    // True if the program for defines has been compiled from the current sources and is
+    // still cached
+    bool hasVariant(const Defines& defines) const;
+    // Bakes standalone d* uniforms into a specialized program as constants once they
+    // have been left alone for a moment, editing any of them switches back to the
+    // generic program
+    void setFreezing(bool freezing);
+    // True if the specialized program is bound
+    bool frozen() const;
+    // Files included in the last load, including the stage roots
+    std::vector<std::string> sourcePaths() const;
+    // Handle stays valid for the lifetime of the shader
+    template<typename T>
+    UniformHandle<T> uniform(const std::string& name)
+    {
+        return UniformHandle<T>(uniformSlot(name, UniformTraits<T>::type));
+    }
+    // Keeps the buffer bound to the block for this and future programs
+    void attachBlock(UniformBuffer& buffer);
     void setFloat(const std::string& name, GLfloat value);
     void setVec2(const std::string& name, GLfloat x, GLfloat y);
     std::unordered_map<std::string, Uniform>& dynamicUniforms();
 
 private:
-    void setVendor();
-    GLuint loadProgram(const std::string& vertPath, const std::string& fragPath,
-                       const std::string& geomPath);
-    GLuint loadShader(const std::string& mainPath, GLenum shaderType);
-    std::string parseFromFile(const std::string& filePath, GLenum shaderType);
+    void startLoad(const std::string& vertPath, const std::string& fragPath,
+                   const std::string& geomPath, bool frozen = false);
+    // Starts loading from the root files of the last load
+    void restartLoad(bool frozen = false);
+    void finishLoad();
+    // Programs built from SPIR-V are reflected from their modules
+    void setProgram(GLuint progID, const SpirvReflection* reflection = nullptr);
+    void addUniform(const std::string& name, GLenum glType, GLint location);
+    // Makes the program the most recently used variant, evicts the least recent
+    void addVariant(const Defines& defines, GLuint progID,
+                    const std::shared_ptr<const SpirvReflection>& reflection);
+    // Bindings SPIR-V modules should use for the blocks
+    std::map<std::string, GLuint> blockBindings() const;
+    void updateFreeze();
+    // Binds the generic program if needed and deletes the specialized one
+    void dropFrozen();
+    // Replaces declarations of dynamic uniforms with constants of the snapshot
+    size_t freezeUniforms(ShaderSource& source) const;
+    // Appends the file with includes expanded to source
+    bool parseFromFile(const std::string& filePath, GLenum shaderType, ShaderSource& source);
     void printProgramLog(GLuint program) const;
-    void printShaderLog(GLuint shader) const;
+    // Error lines are mapped back to the files in source
+    void printShaderLog(GLuint shader, const ShaderSource& source) const;
     GLint getUniform(const std::string& name, UniformType type) const;
+    const GLint* uniformSlot(const std::string& name, UniformType type);
+    void resolveSlot(UniformSlot& slot) const;
     void setUniform(const std::string& name, const Uniform& uniform);
     void setDynamicUniforms();
 #ifdef ROCKET
     void setRocketUniforms(double syncRow);
 #endif // ROCKET
 
-    Vendor _vendor;
     GLuint _progID;
     std::vector<std::vector<std::string> > _filePaths;
-    std::vector<std::vector<time_t> > _fileMods;
     std::unordered_map<std::string, std::pair<UniformType, GLint>> _uniforms;
     std::unordered_map<std::string, Uniform> _dynamicUniforms;
+    // Deque keeps slot addresses stable for handles
+    std::deque<UniformSlot> _uniformSlots;
+    // Flattened for binding, point to values in the maps
+    std::vector<DynamicBinding> _dynamicBindings;
 #ifdef ROCKET
     std::string _name;
     sync_device* _rocket;
     std::unordered_map<std::string, const sync_track*> _rocketUniforms;
+    std::vector<RocketBinding> _rocketBindings;
 #endif // ROCKET
+    std::unique_ptr<UniformBuffer> _paramBlock;
+    std::vector<UniformBuffer*> _blocks;
+    std::shared_ptr<ShaderCompiler::Job> _pendingJob;
+    uint64_t _pendingKey;
+    Timer _compileTime;
+    Defines _defines;
+    Defines _pendingDefines;
+    // Most recently used first, the bound program is at the front once loaded
+    std::list<Variant> _variants;
+    bool _freezing;
+    bool _pendingFrozen;
+    GLuint _frozenProgID;
+    // Values baked into the specialized program or being compiled into it
+    std::unordered_map<std::string, Uniform> _freezeSnapshot;
+    std::unordered_map<std::string, Uniform> _lastValues;
+    Timer _idleTime;
 
 };
 
@@ -0,0 +1,84 @@
+#ifndef SKUNKWORK_SHADERCOMPILER_HPP
+#define SKUNKWORK_SHADERCOMPILER_HPP
+
+#include <GL/gl3w.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "shaderSource.hpp"
+#include "spirvCompiler.hpp"
+#include "window.hpp"
+
+// Compiles and links programs without blocking the render thread
+// Uses KHR/ARB_parallel_shader_compile if available, a few worker threads with
+// shared contexts otherwise. Without init(), compiles happen synchronously on submit.
+// Jobs submitted back to back compile in parallel in both modes.
+class ShaderCompiler
+{
+public:
+    struct Job {
+        // Stage type and preprocessed source
+        std::vector<std::pair<GLenum, ShaderSource>> stages;
+        GLuint program = 0;
+        std::vector<GLuint> shaders;
+        std::atomic<bool> done{false};
+        bool cancelled = false;
+        // Build from SPIR-V if possible, GLSL is the fallback
+        bool spirv = false;
+        uint64_t key = 0;
+        std::map<std::string, GLuint> blockBindings;
+        // Set if the program was built from SPIR-V
+        std::shared_ptr<const SpirvReflection> reflection;
+        // Messages from compilers other than the driver's
+        std::string log;
+    };
+
+    static ShaderCompiler& instance();
+
+    ShaderCompiler(const ShaderCompiler&) = delete;
+    ShaderCompiler& operator=(const ShaderCompiler&) = delete;
+
+    void init(const Window& window);
+    void destroy();
+
+    std::shared_ptr<Job> submit(const std::shared_ptr<Job>& job);
+    // Non-blocking, status queries on a job are free after this returns true
+    bool isDone(const Job& job) const;
+    void wait(const Job& job) const;
+    // Drops the job and its GL objects once the compile has finished
+    void cancel(const std::shared_ptr<Job>& job);
+
+private:
+    enum class Mode {
+        Sync,
+        Parallel,
+        Worker
+    };
+
+    ShaderCompiler();
+    ~ShaderCompiler() { }
+
+    void compile(Job& job) const;
+    bool compileSpirv(Job& job) const;
+    void release(Job& job) const;
+    void run(Window::SharedContext context);
+
+    Mode                                _mode;
+    const Window*                       _window;
+    std::vector<Window::SharedContext>  _contexts;
+    std::vector<std::thread>            _workers;
+    std::mutex                          _mutex;
+    std::condition_variable             _cond;
+    std::deque<std::shared_ptr<Job>>    _queue;
+    bool                                _running;
+
+};
+
+#endif // SKUNKWORK_SHADERCOMPILER_HPP
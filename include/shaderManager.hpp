@@ -0,0 +1,55 @@
+#ifndef SKUNKWORK_SHADERMANAGER_HPP
+#define SKUNKWORK_SHADERMANAGER_HPP
+
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#ifdef ROCKET
+#include <sync.h>
+#endif // ROCKET
+
+#include "shader.hpp"
+#include "timer.hpp"
+
+// Owns all programs and reloads the ones affected by source changes
+// Keeps a reverse graph from every source file to the programs including it, so
+// an edit to a shared include submits all its programs to the compiler at once
+class ShaderManager
+{
+public:
+    ShaderManager();
+
+    ShaderManager(const ShaderManager& other) = delete;
+    ShaderManager operator=(const ShaderManager& other) = delete;
+
+    // Returned shader stays valid for the lifetime of the manager
+#ifdef ROCKET
+    Shader& add(const std::string& name, sync_device* rocket, const std::string& vertPath,
+                const std::string& fragPath, const std::string& geomPath = "");
+#else
+    Shader& add(const std::string& vertPath, const std::string& fragPath,
+                const std::string& geomPath = "");
+#endif // ROCKET
+
+    // Starts reloads for changed sources and swaps in finished programs
+    // Call once per frame
+    void update();
+    // True while any program is still compiling
+    bool pending() const;
+    // True if every shader has a program to draw with
+    bool linked() const;
+
+private:
+    void rebuildGraph();
+
+    // Deque keeps shader addresses stable
+    std::deque<Shader>                                      _shaders;
+    std::unordered_map<std::string, std::vector<Shader*>>   _dependents;
+    std::vector<std::string>                                _changedPaths;
+    std::vector<Shader*>                                    _reloading;
+    Timer                                                   _reloadTime;
+
+};
+
+#endif // SKUNKWORK_SHADERMANAGER_HPP
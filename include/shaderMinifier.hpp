@@ -0,0 +1,50 @@
+#ifndef SKUNKWORK_SHADERMINIFIER_HPP
+#define SKUNKWORK_SHADERMINIFIER_HPP
+
+#include <cstddef>
+
+#include "shaderSource.hpp"
+
+// Trims preprocessed stage sources before they are handed to the driver
+// Functions and constants that main can't reach are stripped, which is most of
+// a library like hg_sdf. Minifying also renames locals, functions and constants
+// and drops whitespace and comments, errors then point to the line a statement
+// started on. Both are on by default in release builds.
+class ShaderMinifier
+{
+public:
+    struct Options {
+        bool strip;
+        bool minify;
+    };
+
+    struct Stats {
+        size_t bytesBefore = 0;
+        size_t bytesAfter = 0;
+        size_t functions = 0;
+        size_t strippedFunctions = 0;
+        size_t constants = 0;
+        size_t strippedConstants = 0;
+    };
+
+    static ShaderMinifier& instance();
+
+    ShaderMinifier(const ShaderMinifier&) = delete;
+    ShaderMinifier& operator=(const ShaderMinifier&) = delete;
+
+    void setOptions(const Options& options);
+    const Options& options() const;
+    bool enabled() const;
+    // Declarations inside preprocessor conditionals that don't balance are kept
+    // Stripped code is replaced by its newlines unless minifying
+    Stats process(ShaderSource& source) const;
+
+private:
+    ShaderMinifier();
+    ~ShaderMinifier() { }
+
+    Options _options;
+
+};
+
+#endif // SKUNKWORK_SHADERMINIFIER_HPP
@@ -0,0 +1,88 @@
+#ifndef SKUNKWORK_SHADERSOURCE_HPP
+#define SKUNKWORK_SHADERSOURCE_HPP
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Source file split at its #include lines
+// Holds a copy of the text, a mapping would fault or change under us if an editor
+// rewrote the file in place while programs still use it
+struct SourceFile {
+    struct Piece {
+        // Text up to the next include or end of file
+        std::string_view text;
+        // Path relative to the including file, empty for text
+        std::string include;
+    };
+
+    SourceFile(std::string&& text) :
+        text(std::move(text))
+    { }
+
+    // Pieces point into this so it must not be modified
+    const std::string   text;
+    std::vector<Piece>  pieces;
+    // Set by #pragma once or a classic #ifndef guard around the whole file
+    bool                once = false;
+};
+
+// Where a segment of a ShaderSource starts
+struct SegmentOrigin {
+    // Index to the source's paths, -1 for generated text
+    int32_t file = -1;
+    // Zero based line in the file
+    uint32_t line = 0;
+};
+
+// Preprocessed stage source as a list of views into source files and owned strings
+// Segments are passed to the driver as is, the full source is never concatenated.
+// Each segment remembers where it starts in its file so errors can be mapped back.
+struct ShaderSource {
+    using Origin = SegmentOrigin;
+
+    ShaderSource() = default;
+    // Views into the strings would dangle in a copy
+    ShaderSource(const ShaderSource& other) = delete;
+    ShaderSource(ShaderSource&& other) = default;
+    ShaderSource& operator=(const ShaderSource& other) = delete;
+    ShaderSource& operator=(ShaderSource&& other) = default;
+
+    // Keeps the files' text alive until the driver has the source
+    std::vector<std::shared_ptr<const SourceFile>> files;
+    // Deque doesn't move existing strings on push
+    std::deque<std::string>                         strings;
+    std::vector<std::string_view>                   segments;
+    // One for each segment
+    std::vector<Origin>                             origins;
+    // Files as they were included, indexed by origins
+    std::vector<std::string>                        paths;
+
+    bool empty() const { return segments.empty(); }
+    size_t length() const;
+    size_t lineCount() const;
+    // Returns the index of path in paths, adding it if needed
+    int32_t pathIndex(const std::string& path);
+    void push(std::string_view segment, Origin origin);
+    // Appends a view to an owned copy of str
+    void append(std::string&& str, Origin origin = Origin());
+    // Inserts an owned copy of str after the #version line or at the start without one
+    void insertAfterVersion(std::string&& str, Origin origin = Origin());
+    // Inserts after the #extension lines following #version, where declarations can go
+    void insertAfterExtensions(std::string&& str, Origin origin = Origin());
+    // Calls replace for each line, lines it fills the replacement for are swapped out
+    // Replacements keep the origin of the line they replace
+    // Returns the number of replaced lines
+    size_t replaceLines(const std::function<bool(std::string_view line,
+                                                 std::string& replacement)>& replace);
+
+private:
+    // Inserts str at offset into segment index, splitting it if needed
+    void insert(size_t index, size_t offset, std::string&& str, Origin origin);
+};
+
+#endif // SKUNKWORK_SHADERSOURCE_HPP
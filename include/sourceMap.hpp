@@ -0,0 +1,49 @@
+#ifndef SKUNKWORK_SOURCEMAP_HPP
+#define SKUNKWORK_SOURCEMAP_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "shaderSource.hpp"
+
+// Maps lines of a preprocessed stage back to the files they came from
+// Built from the segment origins recorded during preprocessing, each lookup is a
+// binary search over runs of consecutive lines from the same file
+class SourceMap
+{
+public:
+    struct Location {
+        const std::string* path;
+        // One based
+        uint32_t line;
+    };
+
+    explicit SourceMap(const ShaderSource& source);
+
+    // String is the source string index the compiler reported and line is one based
+    // Injected text maps to a pseudo path like "<defines>" or "<heatmap>", returns false
+    // only for lines without a recorded origin
+    bool lookup(uint32_t string, uint32_t line, Location& location) const;
+    // Rewrites line references in a compile log to lines in the files and names the
+    // file whenever it changes. Understands the "0(LINE)" style of Nvidia, the
+    // "0:LINE(COL)" of Mesa and the "ERROR: 0:LINE" of AMD and Intel, which glslang
+    // also uses on the SKUNKWORK_SPIRV path.
+    std::string remap(const std::string& log) const;
+
+private:
+    struct Run {
+        uint32_t line;
+        int32_t file;
+        uint32_t fileLine;
+    };
+
+    std::vector<std::string>    _paths;
+    // Sorted by line
+    std::vector<Run>            _runs;
+    // Zero based line each segment starts at
+    std::vector<uint32_t>       _stringLines;
+
+};
+
+#endif // SKUNKWORK_SOURCEMAP_HPP
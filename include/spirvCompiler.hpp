@@ -0,0 +1,76 @@
+#ifndef SKUNKWORK_SPIRVCOMPILER_HPP
+#define SKUNKWORK_SPIRVCOMPILER_HPP
+
+#include <GL/gl3w.h>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "shaderSource.hpp"
+
+// Uniform interface of a program built from SPIR-V
+// Drivers aren't required to keep names for these so they are read from the modules
+struct SpirvReflection {
+    struct Uniform {
+        std::string name;
+        GLenum type;
+        // Location for loose uniforms, byte offset for block members
+        GLint location;
+    };
+
+    struct Block {
+        std::string name;
+        GLint size;
+        std::vector<Uniform> members;
+    };
+
+    std::vector<Uniform> uniforms;
+    std::vector<Block> blocks;
+};
+
+// Stage type and its SPIR-V words
+typedef std::vector<std::pair<GLenum, std::vector<uint32_t>>> SpirvModules;
+
+// Compiles preprocessed stages to SPIR-V with glslang and optimizes them with spirv-opt
+// Only available when built with SKUNKWORK_SPIRV and the context supports
+// GL 4.6 or ARB_gl_spirv. Modules are cached on disk next to program binaries.
+class SpirvCompiler
+{
+public:
+    static SpirvCompiler& instance();
+
+    SpirvCompiler(const SpirvCompiler&) = delete;
+    SpirvCompiler& operator=(const SpirvCompiler&) = delete;
+
+    void init();
+    void destroy();
+    bool supported() const;
+
+    // Thread-safe, errors are written to log instead of the log window
+    // Uniform blocks are bound to the binding given for their name
+    bool compile(uint64_t key, const std::vector<std::pair<GLenum, ShaderSource>>& stages,
+                 const std::map<std::string, GLuint>& blockBindings, SpirvModules& modules,
+                 SpirvReflection& reflection, std::string& log) const;
+    // Returns a specialized shader object, compile status tells if it succeeded
+    GLuint createShader(GLenum stage, const std::vector<uint32_t>& words) const;
+
+private:
+    typedef void (*PFNSPECIALIZESHADER)(GLuint shader, const GLchar* entryPoint,
+                                        GLuint numConstants, const GLuint* constantIndex,
+                                        const GLuint* constantValue);
+
+    SpirvCompiler();
+    ~SpirvCompiler() { }
+
+    bool load(uint64_t key, SpirvModules& modules) const;
+    void store(uint64_t key, const SpirvModules& modules) const;
+    std::string path(uint64_t key) const;
+
+    bool                _supported;
+    PFNSPECIALIZESHADER _specializeShader;
+
+};
+
+#endif // SKUNKWORK_SPIRVCOMPILER_HPP
@@ -0,0 +1,59 @@
+#ifndef SKUNKWORK_SPSCQUEUE_HPP
+#define SKUNKWORK_SPSCQUEUE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Bounded lock-free queue for exactly one producer and one consumer thread
+template<typename T, size_t N>
+class SpscQueue
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "SpscQueue size should be a power of two");
+
+public:
+    SpscQueue() :
+        _head(0),
+        _tail(0)
+    { }
+
+    SpscQueue(const SpscQueue& other) = delete;
+    SpscQueue operator=(const SpscQueue& other) = delete;
+
+    // Producer side, returns false if the queue is full
+    bool push(T&& value)
+    {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _head.load(std::memory_order_acquire) == N)
+            return false;
+        _slots[tail & (N - 1)] = std::move(value);
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, returns false if the queue is empty
+    bool pop(T& value)
+    {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire))
+            return false;
+        value = std::move(_slots[head & (N - 1)]);
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+    }
+
+private:
+    std::array<T, N>                _slots;
+    // Keep the indices on separate cache lines so the threads don't fight over them
+    alignas(64) std::atomic<size_t> _head;
+    alignas(64) std::atomic<size_t> _tail;
+
+};
+
+#endif // SKUNKWORK_SPSCQUEUE_HPP
@@ -0,0 +1,55 @@
+#ifndef SKUNKWORK_TIMEHISTORY_HPP
+#define SKUNKWORK_TIMEHISTORY_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+// Latest times in a fixed ring, pushing overwrites the oldest
+template<uint32_t N>
+class TimeRing
+{
+public:
+    static constexpr uint32_t SIZE = N;
+
+    TimeRing() :
+        _times{},
+        _head(0),
+        _count(0)
+    { }
+
+    void push(float ms)
+    {
+        _times[_head] = ms;
+        _head = (_head + 1) % SIZE;
+        _count = std::min(_count + 1, SIZE);
+    }
+
+    uint32_t size() const { return _count; }
+
+    // Zero is the oldest time
+    float operator[](uint32_t i) const { return _times[(_head + SIZE - _count + i) % SIZE]; }
+
+    // Average of the latest count times
+    float average(uint32_t count) const
+    {
+        count = std::min(count, _count);
+        if (count == 0)
+            return 0.f;
+        float sum = 0.f;
+        for (uint32_t i = _count - count; i < _count; ++i)
+            sum += (*this)[i];
+        return sum / count;
+    }
+
+private:
+    std::array<float, SIZE> _times;
+    uint32_t                _head;
+    uint32_t                _count;
+
+};
+
+// History of a profiled scope
+using TimeHistory = TimeRing<128>;
+
+#endif // SKUNKWORK_TIMEHISTORY_HPP
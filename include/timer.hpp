@@ -2,7 +2,9 @@
 #define TIMER_HPP
 
 #include <chrono>
+#include <cstdint>
 
+// Steady clock so wall clock adjustments don't show up as time jumps
 class Timer
 {
 public:
@@ -11,9 +13,10 @@ public:
 
     void reset();
     float getSeconds() const;
+    uint64_t getNanoseconds() const;
 
 private:
-    std::chrono::time_point<std::chrono::system_clock> _start;
+    std::chrono::time_point<std::chrono::steady_clock> _start;
 
 };
 
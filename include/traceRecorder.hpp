@@ -0,0 +1,72 @@
+#ifndef SKUNKWORK_TRACERECORDER_HPP
+#define SKUNKWORK_TRACERECORDER_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Records cpu scopes and gpu intervals on the cpu profiler's clock
+// Events are streamed as Chrome trace-event json, to be opened in chrome://tracing
+// or Perfetto. Full chunks are formatted and written on a background thread so
+// recording doesn't show up in the frame times it records.
+// Everything but the writer runs on the main thread.
+class TraceRecorder
+{
+public:
+    static constexpr size_t CHUNK_SIZE = 4096;
+
+    static TraceRecorder& instance();
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    // Starts a new trace in TRACE_DIRECTORY
+    void start();
+    // Writes what's left and closes the trace, does nothing if not recording
+    void stop();
+    void toggle();
+    bool recording() const;
+
+    // Times are nanoseconds on CpuProfiler's clock
+    void addCpu(uint32_t thread, const char* name, uint64_t start, uint64_t end);
+    // Interval is marked approximate if it couldn't be calibrated to the cpu clock
+    void addGpu(const std::string& name, uint64_t start, uint64_t end, bool calibrated);
+
+private:
+    struct Event {
+        std::string name;
+        // Cpu threads are their own tracks, the gpu is a separate process
+        bool gpu;
+        uint32_t thread;
+        uint64_t start;
+        uint64_t end;
+        bool calibrated;
+    };
+
+    TraceRecorder();
+    ~TraceRecorder() { }
+
+    void add(Event&& event);
+    void run();
+
+    bool                            _recording;
+    std::string                     _path;
+    std::vector<Event>              _chunk;
+    size_t                          _eventCount;
+    std::ofstream                   _file;
+    // Writer side
+    std::thread                     _writer;
+    std::mutex                      _mutex;
+    std::condition_variable         _cond;
+    std::deque<std::vector<Event>>  _chunks;
+    bool                            _stopping;
+    bool                            _firstEvent;
+
+};
+
+#endif // SKUNKWORK_TRACERECORDER_HPP
@@ -0,0 +1,105 @@
+#ifndef SKUNKWORK_UNIFORM_HPP
+#define SKUNKWORK_UNIFORM_HPP
+
+#include <GL/gl3w.h>
+#include <cstdint>
+
+enum class UniformType {
+    Float,
+    Vec2,
+    Vec3
+};
+
+struct Uniform {
+    UniformType type;
+    float value[3];
+};
+
+// Uniform and uniform buffer uploads issued or skipped as unchanged
+struct UniformStats {
+    uint32_t uploaded = 0;
+    uint32_t skipped = 0;
+
+    // Accumulated until read by the GUI
+    static UniformStats& frame()
+    {
+        static UniformStats stats;
+        return stats;
+    }
+
+    // Counting is skipped while there's no GUI to show it
+    static bool& enabled()
+    {
+        static bool enabled = false;
+        return enabled;
+    }
+
+    static void setEnabled(bool enable)
+    {
+        enabled() = enable;
+        if (!enable)
+            frame() = UniformStats();
+    }
+
+    static void addUploaded()
+    {
+        if (enabled())
+            ++frame().uploaded;
+    }
+
+    static void addSkipped()
+    {
+        if (enabled())
+            ++frame().skipped;
+    }
+};
+
+template<typename T>
+struct UniformTraits;
+
+template<>
+struct UniformTraits<GLfloat> {
+    static constexpr UniformType type = UniformType::Float;
+    static void upload(GLint location, const GLfloat& value) { glUniform1f(location, value); }
+};
+
+template<>
+struct UniformTraits<GLfloat[2]> {
+    static constexpr UniformType type = UniformType::Vec2;
+    static void upload(GLint location, const GLfloat (&value)[2]) { glUniform2fv(location, 1, value); }
+};
+
+template<>
+struct UniformTraits<GLfloat[3]> {
+    static constexpr UniformType type = UniformType::Vec3;
+    static void upload(GLint location, const GLfloat (&value)[3]) { glUniform3fv(location, 1, value); }
+};
+
+// Typed uniform resolved once by the shader and kept up to date across reloads
+// Setting doesn't involve any lookups, the owning shader should be bound
+template<typename T>
+class UniformHandle
+{
+public:
+    UniformHandle() :
+        _location(nullptr)
+    { }
+
+    void set(const T& value) const
+    {
+        if (_location != nullptr)
+            UniformTraits<T>::upload(*_location, value);
+    }
+
+private:
+    friend class Shader;
+
+    explicit UniformHandle(const GLint* location) :
+        _location(location)
+    { }
+
+    const GLint* _location;
+
+};
+
+#endif // SKUNKWORK_UNIFORM_HPP
@@ -0,0 +1,113 @@
+#ifndef SKUNKWORK_UNIFORMBUFFER_HPP
+#define SKUNKWORK_UNIFORMBUFFER_HPP
+
+#include <GL/gl3w.h>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "spirvCompiler.hpp"
+#include "uniform.hpp"
+
+class UniformBuffer;
+
+// Typed member of a uniform block, resolved once and kept up to date across relayouts
+template<typename T>
+class BlockHandle
+{
+public:
+    BlockHandle() :
+        _buffer(nullptr),
+        _offset(nullptr)
+    { }
+
+    void set(const T& value) const;
+
+private:
+    friend class UniformBuffer;
+
+    BlockHandle(UniformBuffer* buffer, const GLint* offset) :
+        _buffer(buffer),
+        _offset(offset)
+    { }
+
+    UniformBuffer* _buffer;
+    const GLint*   _offset;
+
+};
+
+// Backing storage for a std140 uniform block declared without an instance name
+// Values are staged on the cpu and copied to a ring of buffer ranges on upload so
+// frames in flight are never overwritten. The ring is persistently mapped when
+// buffer storage is available. Programs using the same block can share one buffer.
+class UniformBuffer
+{
+public:
+    UniformBuffer(const std::string& blockName, GLuint binding, uint32_t ringSize = 8);
+    ~UniformBuffer();
+
+    UniformBuffer(const UniformBuffer& other) = delete;
+    UniformBuffer operator=(const UniformBuffer& other) = delete;
+
+    // Points the program's block to this buffer's binding
+    // Lays the buffer out from the first program or if the block has changed
+    // Returns false if the program doesn't use the block
+    bool reflect(GLuint program);
+    // Lays the buffer out from a program built from SPIR-V
+    // The binding is baked into the modules
+    void reflect(const SpirvReflection::Block& block);
+
+    template<typename T>
+    BlockHandle<T> member(const std::string& name)
+    {
+        return BlockHandle<T>(this, memberSlot(name, UniformTraits<T>::type));
+    }
+
+    // Byte offset of the member or -1 if the block doesn't have it
+    GLint offset(const std::string& name, UniformType type) const;
+    const std::string& blockName() const;
+    GLuint binding() const;
+    void write(GLint offset, const void* data, size_t size);
+    // Copies staged values to the next range in the ring and binds it
+    // Only binds the current range if nothing was changed since last upload
+    void upload();
+
+private:
+    struct Member {
+        std::string name;
+        UniformType type;
+        GLint offset;
+    };
+
+    void setLayout(GLint size, std::vector<Member>&& layout);
+    const GLint* memberSlot(const std::string& name, UniformType type);
+    void resolveSlot(Member& slot) const;
+    void allocate();
+    void release();
+
+    std::string           _blockName;
+    GLuint                _binding;
+    uint32_t              _ringSize;
+    GLuint                _bufferID;
+    GLint                 _blockSize;
+    GLint                 _stride;
+    uint32_t              _slot;
+    uint8_t*              _mapped;
+    bool                  _dirty;
+    std::vector<GLsync>   _fences;
+    std::vector<uint8_t>  _staging;
+    std::vector<Member>   _layout;
+    // Deque keeps slot addresses stable for handles
+    std::deque<Member>    _memberSlots;
+
+};
+
+template<typename T>
+void BlockHandle<T>::set(const T& value) const
+{
+    if (_offset != nullptr)
+        _buffer->write(*_offset, &value, sizeof(T));
+}
+
+#endif // SKUNKWORK_UNIFORMBUFFER_HPP
@@ -3,13 +3,36 @@
 
 #include <GL/gl3w.h>
 #include <GLFW/glfw3.h>
+#include <cstdint>
+#include <memory>
 #include <string>
 
+#include "frameBuffer.hpp"
+#include "headlessContext.hpp"
+
 class Window
 {
 public:
-    Window() {};
-    bool init(int w, int h, const std::string& title);
+    // Defaults can be overridden from the command line
+    struct Config {
+        int width = 1280;
+        int height = 720;
+        // Renders offscreen through EGL, without a display or input
+        bool headless = false;
+        // Closes the window after this many frames, runs until closed if 0
+        uint32_t frames = 0;
+    };
+
+    // Hidden context that shares objects with the window's, for worker threads
+    struct SharedContext {
+        GLFWwindow* window = nullptr;
+        HeadlessContext::Shared headless;
+
+        bool valid() const;
+    };
+
+    Window();
+    bool init(const Config& config, const std::string& title);
     void destroy();
 
     Window(const Window& other) = delete;
@@ -17,13 +40,27 @@ public:
     Window operator=(const Window& other) = delete;
 
     bool open() const;
+    void close();
+    bool headless() const;
+    // On by default, headless frames aren't synced to anything
+    void setVsync(bool vsync);
+    // Null when headless
     GLFWwindow* ptr() const;
     int width() const;
     int height() const;
     bool drawGUI() const;
+    // Cursor over the window in [0, 1] from the bottom left like gl_FragCoord, 0 when headless
+    float cursorX() const;
+    float cursorY() const;
+
+    SharedContext createSharedContext() const;
+    void destroySharedContext(SharedContext& context) const;
+    // Called from the thread using the context
+    void makeCurrent(const SharedContext& context) const;
+    void releaseCurrent(const SharedContext& context) const;
 
     void startFrame();
-    void endFrame() const;
+    void endFrame();
 
     static void errorCallback(int error, const char* description);
     static void framebufferSizeCallback(GLFWwindow* window, int width, int height);
@@ -34,9 +71,18 @@ public:
     static void charCallback(GLFWwindow* window, unsigned int c);
 
 private:
+    bool initHeadless();
+
     GLFWwindow* _window;
     int _w, _h;
+    float _cursorX, _cursorY;
     bool _drawGUI;
+    uint32_t _frame;
+    uint32_t _frameLimit;
+    bool _closed;
+    HeadlessContext _headless;
+    // Stands in for the default framebuffer when headless
+    std::unique_ptr<FrameBuffer> _target;
 };
 
 #endif // SKUNKWORK_WINDOW_HPP
@@ -5,7 +5,7 @@
 
 uniform vec3 dColor;
 
-out vec4 fragColor;
+layout(location = 0) out vec4 fragColor;
 
 void main()
 {
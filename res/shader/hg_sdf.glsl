@@ -1,3 +1,5 @@
+#pragma once
+
 ////////////////////////////////////////////////////////////////
 //
 //                           HG_SDF
@@ -1,3 +1,5 @@
+#pragma once
+
 // 3D noise function with tweaks (IQ, Shane)
 // Range [0, 1]
 // https://www.shadertoy.com/view/lstGRB
@@ -1,3 +1,5 @@
+#pragma once
+
 struct Material {
     vec3 albedo;
     float metallic;
@@ -1,3 +1,5 @@
+#pragma once
+
 // sRGB, linear space conversions
 float stol(float x) { return (x <= 0.04045 ? x / 12.92 : pow((x + 0.055) / 1.055, 2.4)); }
 vec3 stol(vec3 c) { return vec3(stol(c.x), stol(c.y), stol(c.z)); }
@@ -1,3 +1,8 @@
-uniform float uTime;
-uniform vec2  uRes;
-uniform vec2  uMPos;
+#pragma once
+
+// Engine values shared by all shaders, updated once per frame
+layout(std140) uniform Engine {
+    float uTime;
+    vec2  uRes;
+    vec2  uMPos;
+};
@@ -0,0 +1,291 @@
+#include "abTest.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+
+#include "frameBuffer.hpp"
+#include "log.hpp"
+
+namespace {
+    // Two-sided 95% for the large sample counts the test takes
+    const float Z_95 = 1.96f;
+
+    void meanAndVariance(const std::vector<float>& values, float& mean, float& variance)
+    {
+        double sum = 0.0;
+        for (float v : values)
+            sum += v;
+        mean = (float)(sum / values.size());
+        double squares = 0.0;
+        for (float v : values)
+            squares += (v - mean) * (v - mean);
+        variance = values.size() > 1 ? (float)(squares / (values.size() - 1)) : 0.f;
+    }
+}
+
+ABTest& ABTest::instance()
+{
+    static ABTest test;
+    return test;
+}
+
+ABTest::ABTest() :
+    _initialized(false),
+    _shader(nullptr),
+    _sides{},
+    _phase(Phase::Idle),
+    _time(0.f),
+    _samples(0),
+    _frame(0),
+    _timing(false),
+    _imageWidths{},
+    _imageHeights{},
+    _dropped(0),
+    _status("Idle"),
+    _hasResult(false)
+{ }
+
+void ABTest::destroy()
+{
+    if (!_initialized)
+        return;
+    for (auto& q : _queries) {
+        glDeleteQueries(1, &q.id);
+        q = Query();
+    }
+    _phase = Phase::Idle;
+    _initialized = false;
+}
+
+void ABTest::setShader(Shader& shader)
+{
+    _shader = &shader;
+}
+
+Shader* ABTest::shader() const
+{
+    return _shader;
+}
+
+void ABTest::start(const Side& a, const Side& b, float time, uint32_t samples)
+{
+    if (running())
+        stop();
+    if (!_initialized) {
+        for (auto& q : _queries)
+            glGenQueries(1, &q.id);
+        _initialized = true;
+    }
+
+    _sides = {a, b};
+    _time = time;
+    _samples = std::max(samples, 2u);
+    _frame = 0;
+    _dropped = 0;
+    for (auto& t : _times)
+        t.clear();
+    for (auto& i : _images)
+        i.clear();
+    _hasResult = false;
+    _phase = Phase::Compile;
+    setStatus("Compiling");
+}
+
+void ABTest::stop()
+{
+    if (_phase == Phase::Idle)
+        return;
+    for (auto& q : _queries)
+        q.side = -1;
+    _sides[0].shader->setDefines(_sides[0].defines);
+    _phase = Phase::Idle;
+    if (!_hasResult)
+        setStatus("Stopped");
+}
+
+bool ABTest::running() const
+{
+    return _phase != Phase::Idle;
+}
+
+float ABTest::time() const
+{
+    return _time;
+}
+
+Shader& ABTest::startFrame()
+{
+    collect();
+
+    // Edits leave the sides without current programs, samples so far timed the old code
+    if (_phase != Phase::Idle && _phase != Phase::Compile &&
+        !(_sides[0].shader->hasVariant(_sides[0].defines) &&
+          _sides[1].shader->hasVariant(_sides[1].defines))) {
+        ADD_LOG("[ab] Shader changed, restarting\n");
+        Side a = _sides[0];
+        Side b = _sides[1];
+        start(a, b, _time, _samples);
+    }
+
+    if (_phase == Phase::Compile) {
+        for (int i = 0; i < 2; ++i) {
+            Side& side = _sides[i];
+            if (side.shader->hasVariant(side.defines))
+                continue;
+            if (side.shader->defines() != side.defines) {
+                side.shader->setDefines(side.defines);
+            } else if (!side.shader->pending()) {
+                ADD_LOG("[ab] Side %c failed to compile\n", 'A' + i);
+                stop();
+                setStatus("Side %c failed to compile", 'A' + i);
+                return *_sides[0].shader;
+            }
+            return *side.shader;
+        }
+        _phase = Phase::Sample;
+        setStatus("Sampling");
+    }
+
+    int32_t side = 0;
+    if (_phase == Phase::Sample) {
+        // ABBA keeps a trend from favoring either side
+        uint64_t slot = _frame % 4;
+        side = slot == 0 || slot == 3 ? 0 : 1;
+        if (_frame >= WARMUP_FRAMES) {
+            Query& q = _queries[_frame % _queries.size()];
+            // Still not read back after a full ring, waiting would stall the frame
+            if (q.side >= 0)
+                ++_dropped;
+            q.side = side;
+            glBeginQuery(GL_TIME_ELAPSED, q.id);
+            _timing = true;
+        }
+    } else if (_phase == Phase::CaptureB) {
+        side = 1;
+    }
+    _sides[side].shader->setDefines(_sides[side].defines);
+    return *_sides[side].shader;
+}
+
+void ABTest::endFrame(uint32_t width, uint32_t height)
+{
+    switch (_phase) {
+    case Phase::Sample:
+        if (_timing) {
+            glEndQuery(GL_TIME_ELAPSED);
+            _timing = false;
+        }
+        ++_frame;
+        if (_times[0].size() >= _samples && _times[1].size() >= _samples)
+            _phase = Phase::CaptureA;
+        setStatus("Sampling %zu/%u",
+                  std::min(std::min(_times[0].size(), _times[1].size()), (size_t)_samples),
+                  _samples);
+        break;
+    case Phase::CaptureA:
+    case Phase::CaptureB: {
+        // Capture frames aren't timed so the blocking read is fine
+        size_t side = _phase == Phase::CaptureA ? 0 : 1;
+        _images[side].resize((size_t)width * height * 4);
+        _imageWidths[side] = width;
+        _imageHeights[side] = height;
+        FrameBuffer::bindDefault(GL_READ_FRAMEBUFFER);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, _images[side].data());
+        if (_phase == Phase::CaptureA)
+            _phase = Phase::CaptureB;
+        else
+            finish();
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+const std::string& ABTest::status() const
+{
+    return _status;
+}
+
+bool ABTest::hasResult() const
+{
+    return _hasResult;
+}
+
+const ABTest::Result& ABTest::result() const
+{
+    return _result;
+}
+
+void ABTest::collect()
+{
+    for (auto& q : _queries) {
+        if (q.side < 0)
+            continue;
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(q.id, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available == GL_FALSE)
+            continue;
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(q.id, GL_QUERY_RESULT, &elapsed);
+        _times[q.side].push_back(elapsed * 0.000001f);
+        q.side = -1;
+    }
+}
+
+void ABTest::finish()
+{
+    Result r;
+    float varianceA = 0.f;
+    float varianceB = 0.f;
+    r.samplesA = (uint32_t)_times[0].size();
+    r.samplesB = (uint32_t)_times[1].size();
+    meanAndVariance(_times[0], r.meanA, varianceA);
+    meanAndVariance(_times[1], r.meanB, varianceB);
+    r.difference = r.meanB - r.meanA;
+    r.confidence95 = Z_95 * std::sqrt(varianceA / r.samplesA + varianceB / r.samplesB);
+
+    if (_imageWidths[0] == _imageWidths[1] && _imageHeights[0] == _imageHeights[1] &&
+        !_images[0].empty()) {
+        double squares = 0.0;
+        size_t differing = 0;
+        size_t pixels = _images[0].size() / 4;
+        for (size_t p = 0; p < pixels; ++p) {
+            bool differs = false;
+            for (size_t c = 0; c < 3; ++c) {
+                int d = std::abs((int)_images[0][4 * p + c] - (int)_images[1][4 * p + c]);
+                squares += d * d;
+                r.maxDifference = std::max(r.maxDifference, (uint32_t)d);
+                differs |= d != 0;
+            }
+            differing += differs ? 1 : 0;
+        }
+        r.rmse = (float)std::sqrt(squares / (pixels * 3));
+        r.differingPixels = (float)differing / pixels;
+    }
+
+    _result = r;
+    _hasResult = true;
+    float percent = r.meanA > 0.f ? 100.f * r.difference / r.meanA : 0.f;
+    ADD_LOG("[ab] B - A: %+.3f ms +- %.3f ms (%+.1f%%), %u/%u frames, %u dropped\n",
+            r.difference, r.confidence95, percent, r.samplesA, r.samplesB, _dropped);
+    if (r.rmse >= 0.f)
+        ADD_LOG("[ab] Image rmse %.2f, max difference %u, %.2f%% of pixels differ\n", r.rmse,
+                r.maxDifference, 100.f * r.differingPixels);
+    else
+        ADD_LOG("[ab] Window was resized, images not compared\n");
+    setStatus("Done");
+    stop();
+}
+
+void ABTest::setStatus(const char* fmt, ...)
+{
+    char buf[128];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    _status = buf;
+}
@@ -75,7 +75,12 @@ double AudioStream::getRow() const
 {
     int64_t pos = BASS_ChannelGetPosition(_streamHandle, BASS_POS_BYTE);
     double time = BASS_ChannelBytes2Seconds(_streamHandle, pos);
-    return time * ROW_RATE;
+    return timeToRow(time);
+}
+
+double AudioStream::timeToRow(double seconds) const
+{
+    return seconds * ROW_RATE;
 }
 
 void AudioStream::setRow(int32_t row)
@@ -0,0 +1,122 @@
+#include "commandLine.hpp"
+
+#include <cstdio>
+#include <string>
+
+namespace {
+    void printUsage(const char* program)
+    {
+        fprintf(stderr,
+                "Usage: %s [--headless] [--size WxH] [--frames N]\n"
+                "       [--export PATH --range FIRST:END [--format png|y4m|raw]\n"
+                "        [--export-size WxH] [--fps F] [--workers N [--chunk FRAMES]]]\n"
+                "PATH is a directory for png, a file, - for stdout or '|command' for y4m and raw\n",
+                program);
+    }
+
+    bool parseSize(const char* arg, int& width, int& height)
+    {
+        int w = 0;
+        int h = 0;
+        if (sscanf(arg, "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+            fprintf(stderr, "Invalid size '%s'\n", arg);
+            return false;
+        }
+        width = w;
+        height = h;
+        return true;
+    }
+
+    bool endsWith(const std::string& str, const std::string& suffix)
+    {
+        return str.size() >= suffix.size() &&
+               str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+}
+
+bool CommandLine::parse(int argc, char* argv[])
+{
+    bool hasFormat = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg(argv[i]);
+        bool hasValue = i + 1 < argc;
+        if (arg == "--headless") {
+            window.headless = true;
+        } else if (arg == "--size" && hasValue) {
+            if (!parseSize(argv[++i], window.width, window.height))
+                return false;
+        } else if (arg == "--frames" && hasValue) {
+            int n = 0;
+            if (sscanf(argv[++i], "%d", &n) != 1 || n < 0) {
+                fprintf(stderr, "Invalid frame count '%s'\n", argv[i]);
+                return false;
+            }
+            window.frames = (uint32_t)n;
+        } else if (arg == "--export" && hasValue) {
+            exporter.path = argv[++i];
+        } else if (arg == "--format" && hasValue) {
+            std::string format(argv[++i]);
+            if (format == "png")
+                exporter.format = Exporter::Format::Png;
+            else if (format == "y4m")
+                exporter.format = Exporter::Format::Y4m;
+            else if (format == "raw")
+                exporter.format = Exporter::Format::Raw;
+            else {
+                fprintf(stderr, "Unknown format '%s'\n", format.c_str());
+                return false;
+            }
+            hasFormat = true;
+        } else if (arg == "--export-size" && hasValue) {
+            if (!parseSize(argv[++i], exporter.width, exporter.height))
+                return false;
+        } else if (arg == "--fps" && hasValue) {
+            if (sscanf(argv[++i], "%lf", &exporter.fps) != 1 || exporter.fps <= 0.0) {
+                fprintf(stderr, "Invalid fps '%s'\n", argv[i]);
+                return false;
+            }
+        } else if (arg == "--range" && hasValue) {
+            unsigned first = 0;
+            unsigned end = 0;
+            if (sscanf(argv[++i], "%u:%u", &first, &end) != 2 || end <= first) {
+                fprintf(stderr, "Invalid range '%s'\n", argv[i]);
+                return false;
+            }
+            exporter.first = first;
+            exporter.end = end;
+        } else if (arg == "--workers" && hasValue) {
+            int n = 0;
+            if (sscanf(argv[++i], "%d", &n) != 1 || n < 1) {
+                fprintf(stderr, "Invalid worker count '%s'\n", argv[i]);
+                return false;
+            }
+            exporter.workers = (uint32_t)n;
+        } else if (arg == "--chunk" && hasValue) {
+            int n = 0;
+            if (sscanf(argv[++i], "%d", &n) != 1 || n < 1) {
+                fprintf(stderr, "Invalid chunk size '%s'\n", argv[i]);
+                return false;
+            }
+            exporter.chunkSize = (uint32_t)n;
+        } else {
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+
+    if (!exporter.enabled())
+        return true;
+    if (exporter.end == 0) {
+        fprintf(stderr, "--export needs --range FIRST:END\n");
+        return false;
+    }
+    // Streams can't hold separate png files
+    const std::string& path = exporter.path;
+    if (!hasFormat && (path == "-" || path[0] == '|' || endsWith(path, ".y4m")))
+        exporter.format = Exporter::Format::Y4m;
+    if (exporter.width == 0) {
+        exporter.width = window.width;
+        exporter.height = window.height;
+    }
+    return true;
+}
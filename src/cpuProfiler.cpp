@@ -0,0 +1,170 @@
+#include "cpuProfiler.hpp"
+
+#include <algorithm>
+#include <utility>
+
+#include "traceRecorder.hpp"
+
+CpuProfiler& CpuProfiler::instance()
+{
+    static CpuProfiler profiler;
+    return profiler;
+}
+
+CpuProfiler::CpuProfiler() :
+    _enabled(true),
+    _dropped(0)
+{ }
+
+void CpuProfiler::setEnabled(bool enabled)
+{
+    _enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void CpuProfiler::setThreadName(const std::string& name)
+{
+    ThreadEvents& events = threadEvents();
+    std::lock_guard<std::mutex> lock(_mutex);
+    events.name = name;
+}
+
+void CpuProfiler::startFrame()
+{
+    std::vector<ThreadEvents*> threads;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _threadNames.resize(_threads.size());
+        for (size_t i = 0; i < _threads.size(); ++i) {
+            threads.push_back(_threads[i].get());
+            _threadNames[i] = _threads[i]->name;
+        }
+    }
+
+    // Scopes seen more than once in a frame are summed
+    std::vector<float> times(_scopes.size(), -1.f);
+    std::vector<std::pair<uint32_t, uint64_t>> stack;
+    TraceRecorder& trace = TraceRecorder::instance();
+    for (uint32_t thread = 0; thread < threads.size(); ++thread) {
+        _frameEvents.clear();
+        Event event;
+        while (threads[thread]->events.pop(event))
+            _frameEvents.push_back(event);
+        _dropped += threads[thread]->dropped.exchange(0, std::memory_order_relaxed);
+
+        // Parents start first and end last
+        std::sort(_frameEvents.begin(), _frameEvents.end(), [](const Event& a, const Event& b) {
+            return a.start < b.start || (a.start == b.start && a.end > b.end);
+        });
+        stack.clear();
+        for (const Event& e : _frameEvents) {
+            while (!stack.empty() && stack.back().second <= e.start)
+                stack.pop_back();
+            int32_t parent = stack.empty() ? -1 : (int32_t)stack.back().first;
+            uint32_t scope = scopeIndex(thread, parent, e.name);
+            if (scope >= times.size())
+                times.resize(scope + 1, -1.f);
+            times[scope] = std::max(times[scope], 0.f) + (e.end - e.start) * 0.000001f;
+            stack.emplace_back(scope, e.end);
+            if (trace.recording())
+                trace.addCpu(thread, e.name, e.start, e.end);
+        }
+    }
+
+    for (size_t i = 0; i < times.size(); ++i) {
+        if (times[i] >= 0.f)
+            _scopes[i].times.push(times[i]);
+    }
+}
+
+const std::vector<CpuProfiler::Scope>& CpuProfiler::scopes() const
+{
+    return _scopes;
+}
+
+const std::vector<uint32_t>& CpuProfiler::displayOrder() const
+{
+    return _displayOrder;
+}
+
+uint32_t CpuProfiler::threadCount() const
+{
+    return (uint32_t)_threadNames.size();
+}
+
+const std::string& CpuProfiler::threadName(uint32_t thread) const
+{
+    return _threadNames[thread];
+}
+
+float CpuProfiler::average(const std::string& name, uint32_t frames) const
+{
+    for (auto& s : _scopes) {
+        if (s.parent < 0 && s.name == name)
+            return s.times.average(frames);
+    }
+    return 0.f;
+}
+
+uint32_t CpuProfiler::droppedScopes() const
+{
+    return _dropped;
+}
+
+void CpuProfiler::record(const char* name, uint64_t start, uint64_t end)
+{
+    ThreadEvents& events = threadEvents();
+    // Nobody has collected in a while, better to lose scopes than to block
+    if (!events.events.push({name, start, end}))
+        events.dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+CpuProfiler::ThreadEvents& CpuProfiler::threadEvents()
+{
+    thread_local ThreadEvents* events = nullptr;
+    if (events == nullptr) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _threads.emplace_back(new ThreadEvents());
+        events = _threads.back().get();
+        events->name = "Thread " + std::to_string(_threads.size() - 1);
+        events->dropped = 0;
+    }
+    return *events;
+}
+
+uint32_t CpuProfiler::scopeIndex(uint32_t thread, int32_t parent, const char* name)
+{
+    auto key = std::make_tuple(thread, parent, std::string(name));
+    auto index = _scopeIndices.find(key);
+    if (index != _scopeIndices.end())
+        return index->second;
+
+    uint32_t depth = parent < 0 ? 0 : _scopes[parent].depth + 1;
+    _scopes.push_back({name, thread, parent, depth, TimeHistory()});
+    _scopeIndices.emplace(key, (uint32_t)_scopes.size() - 1);
+    updateDisplayOrder();
+    return (uint32_t)_scopes.size() - 1;
+}
+
+void CpuProfiler::updateDisplayOrder()
+{
+    std::vector<std::vector<uint32_t>> children(_scopes.size());
+    std::vector<uint32_t> stack;
+    for (uint32_t i = 0; i < _scopes.size(); ++i) {
+        if (_scopes[i].parent < 0)
+            stack.push_back(i);
+        else
+            children[_scopes[i].parent].push_back(i);
+    }
+    // Roots are popped in thread order, then in the order they were first seen
+    std::sort(stack.begin(), stack.end(), [&](uint32_t a, uint32_t b) {
+        return std::make_pair(_scopes[a].thread, a) > std::make_pair(_scopes[b].thread, b);
+    });
+
+    _displayOrder.clear();
+    while (!stack.empty()) {
+        uint32_t scope = stack.back();
+        stack.pop_back();
+        _displayOrder.push_back(scope);
+        stack.insert(stack.end(), children[scope].rbegin(), children[scope].rend());
+    }
+}
@@ -0,0 +1,274 @@
+#include "exportCoordinator.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#ifndef _WIN32
+#include <csignal>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif // _WIN32
+
+#include "fileSystem.hpp"
+#include "timer.hpp"
+
+#ifndef _WIN32
+extern char** environ;
+
+namespace {
+    const std::chrono::milliseconds POLL_INTERVAL(20);
+    const size_t COPY_BLOCK = 1 << 20;
+
+    const char* formatName(Exporter::Format format)
+    {
+        switch (format) {
+        case Exporter::Format::Png: return "png";
+        case Exporter::Format::Y4m: return "y4m";
+        case Exporter::Format::Raw: return "raw";
+        }
+        return "";
+    }
+
+    std::string sizeArg(int width, int height)
+    {
+        return std::to_string(width) + "x" + std::to_string(height);
+    }
+}
+#endif // _WIN32
+
+ExportCoordinator::ExportCoordinator(const CommandLine& options, const char* executable) :
+    _options(options),
+    _executable(executable),
+    _partDirectory(EXPORT_DIRECTORY),
+    _nextAssembled(0),
+    _running(0),
+    _retries(0),
+    _output(nullptr),
+    _pipe(false),
+    _failed(false)
+{
+    const Exporter::Config& config = _options.exporter;
+    uint32_t frames = config.end - config.first;
+    uint32_t chunkSize = config.chunkSize;
+    if (chunkSize == 0)
+        chunkSize = std::max(frames / (config.workers * CHUNKS_PER_WORKER), 1u);
+    for (uint32_t first = config.first; first < config.end; first += chunkSize)
+        _chunks.push_back({first, std::min(first + chunkSize, config.end), State::Waiting, 0, -1});
+}
+
+#ifdef _WIN32
+
+bool ExportCoordinator::run()
+{
+    fprintf(stderr, "[export] Worker processes aren't supported on Windows, export without --workers\n");
+    return false;
+}
+
+#else
+
+bool ExportCoordinator::run()
+{
+    const Exporter::Config& config = _options.exporter;
+    Timer timer;
+
+    makeDir(_partDirectory);
+    if (config.format == Exporter::Format::Png) {
+        // Workers write their frames straight into the directory
+        makeDir(config.path);
+    } else {
+        _output = Exporter::openStream(config.path, _pipe);
+        if (_output == nullptr) {
+            fprintf(stderr, "[export] Failed to open '%s'\n", config.path.c_str());
+            return false;
+        }
+        // Workers mustn't hold a pipe open past the coordinator
+        if (_output != stdout)
+            fcntl(fileno(_output), F_SETFD, FD_CLOEXEC);
+    }
+
+    fprintf(stderr, "[export] Frames %u:%u in %zu chunks over %u workers\n", config.first,
+            config.end, _chunks.size(), config.workers);
+
+    while (_nextAssembled < _chunks.size()) {
+        for (Chunk& chunk : _chunks) {
+            if (_failed || _running == config.workers)
+                break;
+            if (chunk.state == State::Waiting && !launch(chunk))
+                _failed = true;
+        }
+        if (!collect() && _failed)
+            break;
+        if (!_failed && !assemble())
+            _failed = true;
+        if (std::any_of(_chunks.begin(), _chunks.end(),
+                        [](const Chunk& c) { return c.state == State::Failed; }))
+            _failed = true;
+        if (_failed) {
+            // Nothing can be written past a missing chunk
+            for (const Chunk& chunk : _chunks)
+                if (chunk.state == State::Running)
+                    kill(chunk.pid, SIGTERM);
+        }
+        if (_nextAssembled < _chunks.size())
+            std::this_thread::sleep_for(POLL_INTERVAL);
+    }
+
+    if (_output != nullptr && !Exporter::closeStream(_output, _pipe)) {
+        fprintf(stderr,
+                "[export] Failed to flush output or the command exited with an error\n");
+        _failed = true;
+    }
+    _output = nullptr;
+
+    if (_failed) {
+        // Logs are kept to see what went wrong
+        for (size_t i = _nextAssembled; i < _chunks.size(); ++i)
+            remove(partPath(_chunks[i]).c_str());
+        fprintf(stderr, "[export] Failed after writing %zu of %zu chunks\n", _nextAssembled,
+                _chunks.size());
+        return false;
+    }
+    float seconds = timer.getSeconds();
+    fprintf(stderr, "[export] Wrote %u frames in %.2fs, %.1f fps, %u retries\n",
+            config.end - config.first, seconds, (config.end - config.first) / seconds, _retries);
+    return true;
+}
+
+bool ExportCoordinator::launch(Chunk& chunk)
+{
+    const Exporter::Config& config = _options.exporter;
+    const Window::Config& window = _options.window;
+    std::string path = config.format == Exporter::Format::Png ? config.path : partPath(chunk);
+    std::string range = std::to_string(chunk.first) + ":" + std::to_string(chunk.end);
+    char fps[32];
+    snprintf(fps, sizeof(fps), "%.17g", config.fps);
+
+    std::vector<std::string> args = {
+        _executable,
+        "--export", path,
+        "--format", formatName(config.format),
+        "--range", range,
+        "--export-size", sizeArg(config.width, config.height),
+        "--fps", fps,
+        "--size", sizeArg(window.width, window.height)
+    };
+    if (window.headless)
+        args.push_back("--headless");
+    std::vector<char*> argv;
+    for (std::string& arg : args)
+        argv.push_back(&arg[0]);
+    argv.push_back(nullptr);
+
+    // Output of each attempt is kept for when it fails
+    std::string log = logPath(chunk);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, log.c_str(),
+                                     O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    posix_spawn_file_actions_adddup2(&actions, STDERR_FILENO, STDOUT_FILENO);
+    pid_t pid = -1;
+    int err = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (err != 0) {
+        fprintf(stderr, "[export] Failed to start '%s': %s\n", argv[0], strerror(err));
+        return false;
+    }
+
+    chunk.state = State::Running;
+    chunk.pid = pid;
+    ++chunk.attempts;
+    ++_running;
+    return true;
+}
+
+bool ExportCoordinator::collect()
+{
+    for (Chunk& chunk : _chunks) {
+        if (chunk.state != State::Running)
+            continue;
+        // Only our workers are reaped, a pipe's command is left to pclose
+        int status = 0;
+        pid_t pid = waitpid(chunk.pid, &status, WNOHANG);
+        if (pid == 0)
+            continue;
+        --_running;
+        chunk.pid = -1;
+        if (pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            chunk.state = State::Done;
+            continue;
+        }
+        if (_failed) {
+            // Stopped by us
+            chunk.state = State::Waiting;
+            continue;
+        }
+
+        if (pid < 0)
+            fprintf(stderr, "[export] Lost worker for frames %u:%u\n", chunk.first, chunk.end);
+        else if (WIFSIGNALED(status))
+            fprintf(stderr, "[export] Frames %u:%u killed by signal %d, see '%s'\n", chunk.first,
+                    chunk.end, WTERMSIG(status), logPath(chunk).c_str());
+        else
+            fprintf(stderr, "[export] Frames %u:%u failed with code %d, see '%s'\n", chunk.first,
+                    chunk.end, WEXITSTATUS(status), logPath(chunk).c_str());
+        if (chunk.attempts < MAX_ATTEMPTS) {
+            chunk.state = State::Waiting;
+            ++_retries;
+        } else {
+            chunk.state = State::Failed;
+        }
+    }
+    return _running > 0;
+}
+
+bool ExportCoordinator::assemble()
+{
+    std::vector<char> buffer;
+    while (_nextAssembled < _chunks.size() && _chunks[_nextAssembled].state == State::Done) {
+        const Chunk& chunk = _chunks[_nextAssembled];
+        if (_output != nullptr) {
+            std::string part = partPath(chunk);
+            FILE* input = fopen(part.c_str(), "rb");
+            if (input == nullptr) {
+                fprintf(stderr, "[export] Missing part '%s'\n", part.c_str());
+                return false;
+            }
+            // Every part starts with the same stream header
+            if (_options.exporter.format == Exporter::Format::Y4m && _nextAssembled > 0) {
+                int c;
+                while ((c = fgetc(input)) != EOF && c != '\n') { }
+            }
+            buffer.resize(COPY_BLOCK);
+            size_t read;
+            bool written = true;
+            while (written && (read = fread(buffer.data(), 1, buffer.size(), input)) > 0)
+                written = fwrite(buffer.data(), 1, read, _output) == read;
+            fclose(input);
+            if (!written) {
+                fprintf(stderr, "[export] Failed to write output\n");
+                return false;
+            }
+            remove(part.c_str());
+        }
+        remove(logPath(chunk).c_str());
+        ++_nextAssembled;
+    }
+    return true;
+}
+
+std::string ExportCoordinator::partPath(const Chunk& chunk) const
+{
+    return _partDirectory + "part_" + std::to_string(getpid()) + "_" +
+           std::to_string(chunk.first) + "." + formatName(_options.exporter.format);
+}
+
+std::string ExportCoordinator::logPath(const Chunk& chunk) const
+{
+    return _partDirectory + "part_" + std::to_string(getpid()) + "_" +
+           std::to_string(chunk.first) + ".log";
+}
+
+#endif // _WIN32
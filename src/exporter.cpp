@@ -0,0 +1,570 @@
+#include "exporter.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <csignal>
+#endif // _WIN32
+
+#include "cpuProfiler.hpp"
+#include "fileSystem.hpp"
+#include "log.hpp"
+
+namespace {
+    const GLuint64 FENCE_TIMEOUT_NS = 1000000000;
+    // Stored deflate blocks can't be longer
+    const size_t MAX_STORED_BLOCK = 65535;
+
+    uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+    {
+        static const std::array<uint32_t, 256> table = []{
+            std::array<uint32_t, 256> t;
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k)
+                    c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                t[i] = c;
+            }
+            return t;
+        }();
+        crc = ~crc;
+        for (size_t i = 0; i < size; ++i)
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    void appendU32(std::vector<uint8_t>& out, uint32_t value)
+    {
+        out.push_back((uint8_t)(value >> 24));
+        out.push_back((uint8_t)(value >> 16));
+        out.push_back((uint8_t)(value >> 8));
+        out.push_back((uint8_t)value);
+    }
+
+    void appendChunk(std::vector<uint8_t>& out, const char* type, const uint8_t* data,
+                     size_t size)
+    {
+        appendU32(out, (uint32_t)size);
+        size_t start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data, data + size);
+        appendU32(out, crc32(out.data() + start, size + 4));
+    }
+
+    // Rgb png with the zlib stream made of stored blocks, rows are flipped to top down
+    void encodePng(const uint8_t* rgba, int width, int height, std::vector<uint8_t>& out)
+    {
+        static const uint8_t SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        out.assign(SIGNATURE, SIGNATURE + 8);
+
+        std::vector<uint8_t> header;
+        appendU32(header, (uint32_t)width);
+        appendU32(header, (uint32_t)height);
+        // 8 bit rgb, default compression, filtering and no interlace
+        header.insert(header.end(), {8, 2, 0, 0, 0});
+        appendChunk(out, "IHDR", header.data(), header.size());
+
+        // Every row starts with filter type 0
+        size_t rowSize = 1 + (size_t)width * 3;
+        std::vector<uint8_t> raw(rowSize * height);
+        for (int y = 0; y < height; ++y) {
+            const uint8_t* src = rgba + (size_t)(height - 1 - y) * width * 4;
+            uint8_t* dst = raw.data() + y * rowSize;
+            *dst++ = 0;
+            for (int x = 0; x < width; ++x, src += 4) {
+                *dst++ = src[0];
+                *dst++ = src[1];
+                *dst++ = src[2];
+            }
+        }
+
+        std::vector<uint8_t> zlib = {0x78, 0x01};
+        zlib.reserve(raw.size() + raw.size() / MAX_STORED_BLOCK * 5 + 16);
+        uint32_t a = 1;
+        uint32_t b = 0;
+        for (size_t offset = 0; ; offset += MAX_STORED_BLOCK) {
+            size_t size = std::min(MAX_STORED_BLOCK, raw.size() - offset);
+            bool last = offset + size == raw.size();
+            zlib.push_back(last ? 1 : 0);
+            zlib.push_back((uint8_t)size);
+            zlib.push_back((uint8_t)(size >> 8));
+            zlib.push_back((uint8_t)~size);
+            zlib.push_back((uint8_t)(~size >> 8));
+            zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + size);
+            for (size_t i = offset; i < offset + size; ++i) {
+                a = (a + raw[i]) % 65521;
+                b = (b + a) % 65521;
+            }
+            if (last)
+                break;
+        }
+        appendU32(zlib, (b << 16) | a);
+        appendChunk(out, "IDAT", zlib.data(), zlib.size());
+        appendChunk(out, "IEND", nullptr, 0);
+    }
+
+    // Limited range BT.601, which y4m readers assume, with chroma averaged over 2x2 blocks
+    // for the centered siting of C420jpeg
+    void encodeY4m(const uint8_t* rgba, int width, int height, std::vector<uint8_t>& out)
+    {
+        static const char FRAME[] = "FRAME\n";
+        size_t lumaSize = (size_t)width * height;
+        size_t chromaSize = lumaSize / 4;
+        out.resize(sizeof(FRAME) - 1 + lumaSize + 2 * chromaSize);
+        memcpy(out.data(), FRAME, sizeof(FRAME) - 1);
+        uint8_t* yPlane = out.data() + sizeof(FRAME) - 1;
+        uint8_t* uPlane = yPlane + lumaSize;
+        uint8_t* vPlane = uPlane + chromaSize;
+
+        auto pixel = [&](int x, int y) {
+            return rgba + ((size_t)(height - 1 - y) * width + x) * 4;
+        };
+        auto clamp = [](float v) {
+            return (uint8_t)std::min(std::max(v + 0.5f, 0.f), 255.f);
+        };
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                const uint8_t* p = pixel(x, y);
+                yPlane[(size_t)y * width + x] = clamp(16.f + 0.256788f * p[0] +
+                                                      0.504129f * p[1] + 0.097906f * p[2]);
+            }
+        }
+        for (int y = 0; y < height; y += 2) {
+            for (int x = 0; x < width; x += 2) {
+                float r = 0.f;
+                float g = 0.f;
+                float b = 0.f;
+                for (int i = 0; i < 4; ++i) {
+                    const uint8_t* p = pixel(x + (i & 1), y + (i >> 1));
+                    r += p[0];
+                    g += p[1];
+                    b += p[2];
+                }
+                r *= 0.25f;
+                g *= 0.25f;
+                b *= 0.25f;
+                size_t c = (size_t)(y / 2) * (width / 2) + x / 2;
+                uPlane[c] = clamp(128.f - 0.148223f * r - 0.290993f * g + 0.439216f * b);
+                vPlane[c] = clamp(128.f + 0.439216f * r - 0.367788f * g - 0.071427f * b);
+            }
+        }
+    }
+
+    void encodeRaw(const uint8_t* rgba, int width, int height, std::vector<uint8_t>& out)
+    {
+        size_t rowSize = (size_t)width * 4;
+        out.resize(rowSize * height);
+        for (int y = 0; y < height; ++y)
+            memcpy(out.data() + y * rowSize, rgba + (height - 1 - y) * rowSize, rowSize);
+    }
+}
+
+FILE* Exporter::openStream(const std::string& path, bool& pipe)
+{
+    pipe = false;
+    if (path == "-") {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif // _WIN32
+        return stdout;
+    }
+    if (path[0] == '|') {
+        pipe = true;
+#ifdef _WIN32
+        return _popen(path.c_str() + 1, "wb");
+#else
+        // Failed writes are reported instead of killing the process
+        signal(SIGPIPE, SIG_IGN);
+        return popen(path.c_str() + 1, "w");
+#endif // _WIN32
+    }
+    return fopen(path.c_str(), "wb");
+}
+
+bool Exporter::closeStream(FILE* stream, bool pipe)
+{
+    bool flushed = fflush(stream) == 0;
+    if (pipe) {
+        // The command failing loses the output as surely as a failed write
+#ifdef _WIN32
+        flushed = _pclose(stream) == 0 && flushed;
+#else
+        flushed = pclose(stream) == 0 && flushed;
+#endif // _WIN32
+    } else if (stream != stdout) {
+        flushed = fclose(stream) == 0 && flushed;
+    }
+    return flushed;
+}
+
+bool Exporter::Config::enabled() const
+{
+    return !path.empty();
+}
+
+Exporter& Exporter::instance()
+{
+    static Exporter exporter;
+    return exporter;
+}
+
+Exporter::Exporter() :
+    _running(false),
+    _finished(false),
+    _frame(0),
+    _pbos{},
+    _fences{},
+    _ringFrames{},
+    _ringStart(0),
+    _ringCount(0),
+    _readStalls(0),
+    _writerStalls(0),
+    _startNs(0),
+    _output(nullptr),
+    _pipe(false),
+    _imageCount(0),
+    _nextWrite(0),
+    _stopping(false),
+    _failed(false)
+{ }
+
+bool Exporter::start(const Config& config)
+{
+    if (_running)
+        return false;
+    if (config.width <= 0 || config.height <= 0 || config.end <= config.first) {
+        ADD_LOG("[export] Invalid size or frame range\n");
+        return false;
+    }
+    if (config.format == Format::Y4m && (config.width % 2 != 0 || config.height % 2 != 0)) {
+        ADD_LOG("[export] 4:2:0 needs an even size, got %dx%d\n", config.width, config.height);
+        return false;
+    }
+
+    _config = config;
+    if (!openOutput())
+        return false;
+
+    _target = std::make_unique<FrameBuffer>(
+        _config.width, _config.height,
+        std::vector<TextureParams>({{GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_LINEAR,
+                                     GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE}}),
+        GL_DEPTH_COMPONENT24, GL_DEPTH_ATTACHMENT
+    );
+    GLsizeiptr imageSize = (GLsizeiptr)_config.width * _config.height * 4;
+    glGenBuffers(RING_SIZE, _pbos.data());
+    for (GLuint pbo : _pbos) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, imageSize, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    _fences.fill(nullptr);
+    _ringStart = 0;
+    _ringCount = 0;
+    _readStalls = 0;
+    _writerStalls = 0;
+
+    _frame = _config.first;
+    _nextWrite = _config.first;
+    _imageCount = 0;
+    _stopping = false;
+    _failed = false;
+    _error.clear();
+    // Leave a core for the render thread and the driver
+    unsigned writerCount = std::thread::hardware_concurrency();
+    writerCount = std::max(1u, std::min(MAX_WRITERS, writerCount > 1 ? writerCount - 1 : 1));
+    for (unsigned i = 0; i < writerCount; ++i)
+        _writers.emplace_back(&Exporter::run, this);
+
+    _running = true;
+    _finished = false;
+    _startNs = CpuProfiler::instance().now();
+    ADD_LOG("[export] Frames %u-%u at %dx%d, %g fps to '%s' with %u writers\n", _config.first,
+            _config.end - 1, _config.width, _config.height, _config.fps, _config.path.c_str(),
+            writerCount);
+    if (_config.format == Format::Raw)
+        ADD_LOG("[export] Read with: ffmpeg -f rawvideo -pix_fmt rgba -s %dx%d -r %g -i ...\n",
+                _config.width, _config.height, _config.fps);
+    return true;
+}
+
+void Exporter::stop()
+{
+    if (!_running)
+        return;
+
+    // Frames still in flight are written unless a writer already failed
+    while (_ringCount > 0)
+        retire();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _cond.notify_all();
+    for (auto& writer : _writers)
+        writer.join();
+    _writers.clear();
+    _queue.clear();
+    _free.clear();
+    closeOutput();
+
+    glDeleteBuffers(RING_SIZE, _pbos.data());
+    _pbos.fill(0);
+    _target.reset();
+    _running = false;
+
+    uint32_t frames = _frame - _config.first;
+    double seconds = (CpuProfiler::instance().now() - _startNs) * 1e-9;
+    if (_failed) {
+        ADD_LOG("[export] Failed: %s\n", _error.c_str());
+        return;
+    }
+    ADD_LOG("[export] Wrote %u frames in %.1f s, %.1f fps\n", frames, seconds,
+            seconds > 0.0 ? frames / seconds : 0.0);
+    ADD_LOG("[export] %u readbacks weren't ready, waited %u times on writers\n", _readStalls,
+            _writerStalls);
+}
+
+bool Exporter::running() const
+{
+    return _running;
+}
+
+bool Exporter::finished() const
+{
+    return _finished;
+}
+
+bool Exporter::complete() const
+{
+    return _finished && !_failed;
+}
+
+double Exporter::time() const
+{
+    return _frame / _config.fps;
+}
+
+uint32_t Exporter::frame() const
+{
+    return _frame;
+}
+
+int Exporter::width() const
+{
+    return _config.width;
+}
+
+int Exporter::height() const
+{
+    return _config.height;
+}
+
+void Exporter::startFrame()
+{
+    _target->bindWrite();
+    glViewport(0, 0, _config.width, _config.height);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void Exporter::endFrame(int windowWidth, int windowHeight)
+{
+    CpuScope scope("Readback");
+    uint32_t slot = (_ringStart + _ringCount) % RING_SIZE;
+    _target->bindReadBuffer(0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _pbos[slot]);
+    glReadPixels(0, 0, _config.width, _config.height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    _fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    _ringFrames[slot] = _frame;
+    ++_ringCount;
+
+    // Preview, the target is still bound for reading
+    FrameBuffer::bindDefault(GL_DRAW_FRAMEBUFFER);
+    glBlitFramebuffer(0, 0, _config.width, _config.height, 0, 0, windowWidth, windowHeight,
+                      GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    FrameBuffer::bindDefault();
+    glViewport(0, 0, windowWidth, windowHeight);
+
+    // Frames issued after the oldest read have given it time to finish
+    if (_ringCount == RING_SIZE)
+        retire();
+
+    ++_frame;
+    if (_frame == _config.end || _failed) {
+        stop();
+        _finished = true;
+    }
+}
+
+bool Exporter::openOutput()
+{
+    _pipe = false;
+    _output = nullptr;
+    const std::string& path = _config.path;
+    if (_config.format == Format::Png) {
+        makeDir(path);
+        return true;
+    }
+
+    _output = openStream(path, _pipe);
+    if (_output == nullptr) {
+        ADD_LOG("[export] Failed to open '%s'\n", path.c_str());
+        return false;
+    }
+
+    if (_config.format == Format::Y4m) {
+        // Rate as a fraction, e.g. 30000:1001 for 29.97
+        uint64_t num = (uint64_t)std::llround(_config.fps * 1000.0);
+        uint64_t den = 1000;
+        uint64_t divisor = std::gcd(num, den);
+        fprintf(_output, "YUV4MPEG2 W%d H%d F%llu:%llu Ip A1:1 C420jpeg\n", _config.width,
+                _config.height, (unsigned long long)(num / divisor),
+                (unsigned long long)(den / divisor));
+    }
+    return true;
+}
+
+void Exporter::closeOutput()
+{
+    if (_output == nullptr)
+        return;
+    if (!closeStream(_output, _pipe) && !_failed)
+        fail("Failed to flush output or the command exited with an error");
+    _output = nullptr;
+}
+
+void Exporter::retire()
+{
+    uint32_t slot = _ringStart;
+    _ringStart = (_ringStart + 1) % RING_SIZE;
+    --_ringCount;
+
+    GLsync fence = _fences[slot];
+    _fences[slot] = nullptr;
+    if (_failed) {
+        glDeleteSync(fence);
+        return;
+    }
+    GLenum status = glClientWaitSync(fence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+        ++_readStalls;
+        glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT_NS);
+    }
+    glDeleteSync(fence);
+
+    // Images are only allocated when writers hold on to all of them
+    std::unique_ptr<Image> image;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        size_t maxImages = _writers.size() * 2;
+        if (_free.empty() && _imageCount >= maxImages) {
+            ++_writerStalls;
+            _cond.wait(lock, [&]{ return !_free.empty() || _failed; });
+        }
+        if (_failed)
+            return;
+        if (!_free.empty()) {
+            image = std::move(_free.back());
+            _free.pop_back();
+        } else {
+            image = std::make_unique<Image>();
+            ++_imageCount;
+        }
+    }
+
+    size_t imageSize = (size_t)_config.width * _config.height * 4;
+    image->frame = _ringFrames[slot];
+    image->pixels.resize(imageSize);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _pbos[slot]);
+    void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, imageSize, GL_MAP_READ_BIT);
+    if (data != nullptr) {
+        memcpy(image->pixels.data(), data, imageSize);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (data == nullptr) {
+        fail("Failed to map frame " + std::to_string(image->frame));
+        _free.emplace_back(std::move(image));
+        return;
+    }
+    _queue.emplace_back(std::move(image));
+    _cond.notify_all();
+}
+
+void Exporter::run()
+{
+    CpuProfiler::instance().setThreadName("Writer");
+    bool stream = _config.format != Format::Png;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _cond.wait(lock, [&]{ return _stopping || !_queue.empty(); });
+        // Stopping only after the queue is drained
+        if (_queue.empty())
+            break;
+
+        auto image = std::move(_queue.front());
+        _queue.pop_front();
+        lock.unlock();
+
+        bool written = _failed || encode(*image);
+        if (stream && !_failed) {
+            lock.lock();
+            _cond.wait(lock, [&]{ return _nextWrite == image->frame || _failed; });
+            lock.unlock();
+            // The others wait for their turn so the stream is ours
+            if (!_failed) {
+                size_t size = image->encoded.size();
+                written = fwrite(image->encoded.data(), 1, size, _output) == size;
+            }
+        }
+
+        lock.lock();
+        if (!written && !_failed)
+            fail("Failed to write frame " + std::to_string(image->frame));
+        ++_nextWrite;
+        _free.emplace_back(std::move(image));
+        _cond.notify_all();
+    }
+}
+
+bool Exporter::encode(Image& image) const
+{
+    CpuScope scope("Encode");
+    switch (_config.format) {
+    case Format::Png: {
+        encodePng(image.pixels.data(), _config.width, _config.height, image.encoded);
+        char name[32];
+        snprintf(name, sizeof(name), "/frame_%06u.png", image.frame);
+        FILE* file = fopen((_config.path + name).c_str(), "wb");
+        if (file == nullptr)
+            return false;
+        size_t size = image.encoded.size();
+        bool written = fwrite(image.encoded.data(), 1, size, file) == size;
+        return fclose(file) == 0 && written;
+    }
+    case Format::Y4m:
+        encodeY4m(image.pixels.data(), _config.width, _config.height, image.encoded);
+        return true;
+    case Format::Raw:
+        encodeRaw(image.pixels.data(), _config.width, _config.height, image.encoded);
+        return true;
+    }
+    return false;
+}
+
+void Exporter::fail(const std::string& error)
+{
+    // Called with the lock held or with the writers joined, logged by the main thread
+    _error = error;
+    _failed = true;
+    _cond.notify_all();
+}
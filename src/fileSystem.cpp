@@ -0,0 +1,42 @@
+#include "fileSystem.hpp"
+
+#include <cstdio>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif // _WIN32
+
+void makeDir(const std::string& path)
+{
+#ifdef _WIN32
+    _mkdir(path.c_str());
+#else
+    mkdir(path.c_str(), 0755);
+#endif // _WIN32
+}
+
+std::string tempPath(const std::string& path)
+{
+#ifdef _WIN32
+    int pid = _getpid();
+#else
+    int pid = (int)getpid();
+#endif // _WIN32
+    return path + "." + std::to_string(pid) + ".tmp";
+}
+
+bool replaceFile(const std::string& from, const std::string& to)
+{
+#ifdef _WIN32
+    // Rename doesn't replace existing files here
+    remove(to.c_str());
+#endif // _WIN32
+    if (rename(from.c_str(), to.c_str()) != 0) {
+        remove(from.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,214 @@
+#include "fileWatcher.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <sys/stat.h>
+#include <unordered_set>
+#ifdef __linux__
+#include <cerrno>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif // __linux__
+
+#include "log.hpp"
+
+namespace {
+#ifdef __linux__
+    // Editors tend to save through a burst of events (write temp, rename, chmod, ...)
+    // so wait for the directory to go quiet before reporting
+    const int COALESCE_MS = 30;
+#else
+    const auto POLL_INTERVAL = std::chrono::milliseconds(100);
+
+    time_t getMod(const std::string& path) {
+        struct stat sb;
+        if (stat(path.c_str(), &sb) == -1)
+            return (time_t) - 1;
+        return sb.st_mtime;
+    }
+#endif // __linux__
+}
+
+FileWatcher& FileWatcher::instance()
+{
+    static FileWatcher watcher;
+    return watcher;
+}
+
+#ifdef __linux__
+FileWatcher::FileWatcher() :
+    _running(false),
+    _inotifyFD(-1),
+    _wakeFDs{-1, -1}
+{
+    _inotifyFD = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_inotifyFD == -1) {
+        ADD_LOG("[watcher] inotify init failed, shaders won't auto-reload\n");
+        return;
+    }
+    if (pipe(_wakeFDs) == -1) {
+        ADD_LOG("[watcher] Wake pipe creation failed, shaders won't auto-reload\n");
+        close(_inotifyFD);
+        _inotifyFD = -1;
+        return;
+    }
+    _running = true;
+    _thread = std::thread(&FileWatcher::run, this);
+}
+
+FileWatcher::~FileWatcher()
+{
+    if (_running) {
+        _running = false;
+        char wake = 0;
+        (void) !write(_wakeFDs[1], &wake, 1);
+        _thread.join();
+    }
+    if (_inotifyFD != -1) close(_inotifyFD);
+    if (_wakeFDs[0] != -1) close(_wakeFDs[0]);
+    if (_wakeFDs[1] != -1) close(_wakeFDs[1]);
+}
+
+void FileWatcher::watch(const std::string& path)
+{
+    if (_inotifyFD == -1)
+        return;
+
+    char resolved[PATH_MAX];
+    if (realpath(path.c_str(), resolved) == nullptr) {
+        ADD_LOG("[watcher] Unable to resolve '%s'\n", path.c_str());
+        return;
+    }
+    std::string canonical(resolved);
+
+    std::lock_guard<std::mutex> lock(_watchMutex);
+    auto& paths = _watchFiles[canonical];
+    if (std::find(paths.begin(), paths.end(), path) != paths.end())
+        return;
+    paths.emplace_back(path);
+
+    // Watch the directory instead of the file since atomic saves replace the inode
+    std::string dirPath = canonical.substr(0, canonical.find_last_of('/'));
+    int wd = inotify_add_watch(_inotifyFD, dirPath.c_str(),
+                               IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (wd == -1) {
+        ADD_LOG("[watcher] Unable to watch '%s'\n", dirPath.c_str());
+        return;
+    }
+    _watchDirs[wd] = dirPath;
+}
+
+void FileWatcher::run()
+{
+    pollfd fds[2] = {{_inotifyFD, POLLIN, 0}, {_wakeFDs[0], POLLIN, 0}};
+    std::unordered_set<std::string> pending;
+    alignas(inotify_event) char buf[4096];
+
+    while (_running) {
+        int ret = ::poll(fds, 2, pending.empty() ? -1 : COALESCE_MS);
+        if (ret == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents & POLLIN)
+            break;
+
+        // Timed out so the burst is over, publish the changes
+        if (ret == 0) {
+            for (auto it = pending.begin(); it != pending.end();) {
+                std::string path = *it;
+                if (!_changes.push(std::move(path)))
+                    break; // Full, retry after the next timeout
+                it = pending.erase(it);
+            }
+            continue;
+        }
+
+        ssize_t len;
+        while ((len = read(_inotifyFD, buf, sizeof(buf))) > 0) {
+            std::lock_guard<std::mutex> lock(_watchMutex);
+            for (char* ptr = buf; ptr < buf + len;) {
+                const inotify_event* event = (const inotify_event*)ptr;
+                ptr += sizeof(inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW) {
+                    // Events were dropped, assume everything changed
+                    for (auto& f : _watchFiles)
+                        pending.insert(f.second.begin(), f.second.end());
+                    continue;
+                }
+                if (event->len == 0)
+                    continue;
+
+                auto dir = _watchDirs.find(event->wd);
+                if (dir == _watchDirs.end())
+                    continue;
+                auto file = _watchFiles.find(dir->second + '/' + event->name);
+                if (file != _watchFiles.end())
+                    pending.insert(file->second.begin(), file->second.end());
+            }
+        }
+    }
+}
+#else
+FileWatcher::FileWatcher() :
+    _running(true)
+{
+    _thread = std::thread(&FileWatcher::run, this);
+}
+
+FileWatcher::~FileWatcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(_watchMutex);
+        _running = false;
+    }
+    _wakeCond.notify_one();
+    _thread.join();
+}
+
+void FileWatcher::watch(const std::string& path)
+{
+    time_t mod = getMod(path);
+    std::lock_guard<std::mutex> lock(_watchMutex);
+    _fileMods.insert({path, mod});
+}
+
+void FileWatcher::run()
+{
+    std::unique_lock<std::mutex> lock(_watchMutex);
+    std::unordered_set<std::string> pending;
+    while (_running) {
+        _wakeCond.wait_for(lock, POLL_INTERVAL);
+        for (auto& f : _fileMods) {
+            time_t mod = getMod(f.first);
+            if (mod != f.second) {
+                f.second = mod;
+                pending.insert(f.first);
+            }
+        }
+        for (auto it = pending.begin(); it != pending.end();) {
+            std::string path = *it;
+            if (!_changes.push(std::move(path)))
+                break;
+            it = pending.erase(it);
+        }
+    }
+}
+#endif // __linux__
+
+bool FileWatcher::poll(std::vector<std::string>& changedPaths)
+{
+    if (_changes.empty())
+        return false;
+
+    changedPaths.clear();
+    for (std::string path; _changes.pop(path);) {
+        if (std::find(changedPaths.begin(), changedPaths.end(), path) == changedPaths.end())
+            changedPaths.emplace_back(std::move(path));
+    }
+    return true;
+}
@@ -2,6 +2,10 @@
 
 #include "log.hpp"
 
+namespace {
+    GLuint defaultFbo = 0;
+}
+
 FrameBuffer::FrameBuffer(uint32_t w, uint32_t h, const std::vector<TextureParams>& texParams,
                          GLenum depthFormat, GLenum depthAttachment) :
     _depthRbo(0)
@@ -40,13 +44,14 @@ FrameBuffer::FrameBuffer(uint32_t w, uint32_t h, const std::vector<TextureParams
         glFramebufferRenderbuffer(GL_FRAMEBUFFER, depthAttachment, GL_RENDERBUFFER, _depthRbo);
     }
 
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-
-    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    // Checked while bound, the default one is undefined without a window
+    GLenum status = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
     if (status != GL_FRAMEBUFFER_COMPLETE) {
         ADD_LOG("[framebuffer] Init failed\n");
         ADD_LOG("[framebuffer] Status: %u\n", status);
     }
+
+    bindDefault(GL_DRAW_FRAMEBUFFER);
 }
 
 FrameBuffer::~FrameBuffer()
@@ -73,6 +78,12 @@ void FrameBuffer::bindWrite()
     glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
 }
 
+void FrameBuffer::bindReadBuffer(uint32_t texNum)
+{
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, _fbo);
+    glReadBuffer(GL_COLOR_ATTACHMENT0 + texNum);
+}
+
 void FrameBuffer::bindRead(uint32_t texNum, GLenum texUnit, GLint uniform)
 {
     if (texNum < _texIDs.size()) {
@@ -101,3 +112,13 @@ void FrameBuffer::resize(uint32_t w, uint32_t h)
         glRenderbufferStorage(GL_RENDERBUFFER, _depthFormat, w, h);
     }
 }
+
+void FrameBuffer::bindDefault(GLenum target)
+{
+    glBindFramebuffer(target, defaultFbo);
+}
+
+void FrameBuffer::setDefault(const FrameBuffer* frameBuffer)
+{
+    defaultFbo = frameBuffer != nullptr ? frameBuffer->_fbo : 0;
+}
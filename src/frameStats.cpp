@@ -0,0 +1,133 @@
+#include "frameStats.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+
+#include "log.hpp"
+
+namespace {
+    float percentile(const std::vector<float>& sorted, float p)
+    {
+        size_t i = (size_t)(p * (sorted.size() - 1) + 0.5f);
+        return sorted[std::min(i, sorted.size() - 1)];
+    }
+}
+
+FrameStats& FrameStats::instance()
+{
+    static FrameStats stats;
+    return stats;
+}
+
+FrameStats::FrameStats() :
+    _started(false),
+    _frame(0),
+    // Catches a missed vsync at 60 Hz
+    _budget(25.f),
+    _hitches(0),
+    _logHitches(true),
+    _hitchLogged(false),
+    _unloggedHitches(0)
+{ }
+
+void FrameStats::endFrame(double syncRow)
+{
+    float ms = _timer.getNanoseconds() * 0.000001f;
+    _timer.reset();
+    ++_frame;
+    // Nothing to measure the first frame against
+    if (!_started) {
+        _started = true;
+        return;
+    }
+
+    _cpu.push(ms);
+    if (ms <= _budget)
+        return;
+    ++_hitches;
+    if (!_logHitches)
+        return;
+    // Slow machines would hitch every frame
+    if (_hitchLogged && _hitchLogTimer.getSeconds() < HITCH_LOG_INTERVAL_S) {
+        ++_unloggedHitches;
+        return;
+    }
+    _hitchLogged = true;
+    _hitchLogTimer.reset();
+
+    float gpuMs = _gpu.size() > 0 ? _gpu[_gpu.size() - 1] : 0.f;
+    char skipped[48] = "";
+    if (_unloggedHitches > 0)
+        snprintf(skipped, sizeof(skipped), ", %u more since the last one", _unloggedHitches);
+    _unloggedHitches = 0;
+    if (syncRow >= 0.0)
+        ADD_LOG("[stats] Frame %" PRIu64 " took %.1f ms at row %.2f, last gpu frame %.1f ms%s\n",
+                _frame, ms, syncRow, gpuMs, skipped);
+    else
+        ADD_LOG("[stats] Frame %" PRIu64 " took %.1f ms, last gpu frame %.1f ms%s\n",
+                _frame, ms, gpuMs, skipped);
+}
+
+void FrameStats::addGpuFrame(float ms)
+{
+    _gpu.push(ms);
+}
+
+void FrameStats::setBudget(float ms)
+{
+    _budget = ms;
+}
+
+void FrameStats::setLogHitches(bool log)
+{
+    _logHitches = log;
+}
+
+float FrameStats::budget() const
+{
+    return _budget;
+}
+
+uint32_t FrameStats::hitches() const
+{
+    return _hitches;
+}
+
+const FrameStats::History& FrameStats::cpuTimes() const
+{
+    return _cpu;
+}
+
+const FrameStats::History& FrameStats::gpuTimes() const
+{
+    return _gpu;
+}
+
+FrameStats::Summary FrameStats::summarize(const History& times)
+{
+    Summary summary;
+    if (times.size() == 0)
+        return summary;
+
+    std::vector<float> sorted(times.size());
+    for (uint32_t i = 0; i < times.size(); ++i)
+        sorted[i] = times[i];
+    std::sort(sorted.begin(), sorted.end());
+    summary.p50 = percentile(sorted, 0.5f);
+    summary.p95 = percentile(sorted, 0.95f);
+    summary.p99 = percentile(sorted, 0.99f);
+    summary.max = sorted.back();
+    return summary;
+}
+
+void FrameStats::histogram(const History& times, float maxMs, std::vector<float>& bins)
+{
+    std::fill(bins.begin(), bins.end(), 0.f);
+    if (bins.empty() || maxMs <= 0.f)
+        return;
+    for (uint32_t i = 0; i < times.size(); ++i) {
+        size_t bin = (size_t)(times[i] / maxMs * bins.size());
+        ++bins[std::min(bin, bins.size() - 1)];
+    }
+}
@@ -0,0 +1,24 @@
+#include "glExtensions.hpp"
+
+#include <GL/gl3w.h>
+#include <cstring>
+
+bool hasGLExtension(const char* name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i) {
+        if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool hasGLVersion(int major, int minor)
+{
+    GLint ctxMajor = 0;
+    GLint ctxMinor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &ctxMajor);
+    glGetIntegerv(GL_MINOR_VERSION, &ctxMinor);
+    return ctxMajor > major || (ctxMajor == major && ctxMinor >= minor);
+}
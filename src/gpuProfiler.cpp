@@ -1,35 +1,307 @@
 #include "gpuProfiler.hpp"
 
-GpuProfiler::GpuProfiler(uint32_t window) :
-    _backActive(false),
-    _times(window, 0.f)
+#include <algorithm>
+
+#include "cpuProfiler.hpp"
+#include "frameStats.hpp"
+#include "glExtensions.hpp"
+#include "log.hpp"
+#include "traceRecorder.hpp"
+
+#ifndef GL_PRIMITIVES_SUBMITTED_ARB
+#define GL_PRIMITIVES_SUBMITTED_ARB 0x82EF
+#endif // GL_PRIMITIVES_SUBMITTED_ARB
+#ifndef GL_FRAGMENT_SHADER_INVOCATIONS_ARB
+#define GL_FRAGMENT_SHADER_INVOCATIONS_ARB 0x82F4
+#endif // GL_FRAGMENT_SHADER_INVOCATIONS_ARB
+
+GpuProfiler& GpuProfiler::instance()
+{
+    static GpuProfiler profiler;
+    return profiler;
+}
+
+GpuProfiler::GpuProfiler() :
+    _initialized(false),
+    _timestamps(false),
+    _frameIndex(0),
+    _inFrame(false),
+    _dropped(0),
+    _statTargets{},
+    _pipelineStats(false),
+    _statsOpen(false),
+    _clockOffset(0),
+    _calibrated(false),
+    _calibrationFrame(0)
+{ }
+
+void GpuProfiler::init()
 {
-    glGenQueries(2, _queryIDs);
-    // Set the "back" counter
-    GLint done = 0;
-    glBeginQuery(GL_TIME_ELAPSED, _queryIDs[1]);
-    glEndQuery(GL_TIME_ELAPSED);
-    while (!done) glGetQueryObjectiv(_queryIDs[1], GL_QUERY_RESULT_AVAILABLE, &done);
+    for (auto& frame : _frames) {
+        glGenQueries((GLsizei)frame.queries.size(), frame.queries.data());
+        glGenQueries((GLsizei)frame.statQueries.size(), frame.statQueries.data());
+    }
+
+    GLint bits = 0;
+    glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &bits);
+#ifdef __APPLE__
+    // Reported as supported but the results are garbage
+    bits = 0;
+#endif // __APPLE__
+    _timestamps = bits > 0;
+    if (!_timestamps)
+        ADD_LOG("[profiler] Timestamps not supported, nested scopes won't be timed\n");
+
+    if (hasGLVersion(4, 6) || hasGLExtension("GL_ARB_pipeline_statistics_query")) {
+        _statTargets[0] = GL_FRAGMENT_SHADER_INVOCATIONS_ARB;
+        _statTargets[1] = GL_PRIMITIVES_SUBMITTED_ARB;
+    } else {
+        ADD_LOG("[profiler] Pipeline statistics not supported, only samples are counted\n");
+    }
+    _statTargets[2] = GL_SAMPLES_PASSED;
+    _initialized = true;
 }
 
-void GpuProfiler::startSample()
+void GpuProfiler::destroy()
 {
-    glBeginQuery(GL_TIME_ELAPSED, _queryIDs[_backActive ? 1 : 0]);
+    if (!_initialized)
+        return;
+    for (auto& frame : _frames) {
+        glDeleteQueries((GLsizei)frame.queries.size(), frame.queries.data());
+        glDeleteQueries((GLsizei)frame.statQueries.size(), frame.statQueries.data());
+        frame.samples.clear();
+        frame.pending = false;
+    }
+    _initialized = false;
 }
 
-void GpuProfiler::endSample()
+void GpuProfiler::startFrame()
 {
-    glEndQuery(GL_TIME_ELAPSED);
-    _times.erase(_times.begin());
-    GLint64 elapsed;
-    glGetQueryObjecti64v(_queryIDs[_backActive ? 0 : 1], GL_QUERY_RESULT, &elapsed);
-    _times.emplace_back(elapsed * 0.000001f);
-    _backActive = !_backActive;
+    if (!_initialized)
+        init();
+    calibrate();
+
+    // Oldest frame is in the pool about to be reused, results come in order
+    for (uint32_t i = 0; i < FRAME_LATENCY; ++i) {
+        Frame& frame = _frames[(_frameIndex + i) % FRAME_LATENCY];
+        if (frame.pending && !collect(frame))
+            break;
+    }
+
+    Frame& frame = _frames[_frameIndex % FRAME_LATENCY];
+    if (frame.pending) {
+        // Waiting for it would stall on the gpu, which is what we're measuring
+        frame.pending = false;
+        ++_dropped;
+    }
+    frame.samples.clear();
+    frame.cpuStart = CpuProfiler::instance().now();
+    _stack.clear();
+    _statsOpen = false;
+    _inFrame = true;
 }
 
-float GpuProfiler::getAvg() const
+void GpuProfiler::endFrame()
 {
-    float sum = 0.f;
-    for (auto i : _times) sum += i;
-    return sum / _times.size();
+    if (!_inFrame)
+        return;
+    if (!_stack.empty()) {
+        ADD_LOG("[profiler] %zu scopes left open at the end of the frame\n", _stack.size());
+        while (!_stack.empty())
+            end();
+    }
+    Frame& frame = _frames[_frameIndex % FRAME_LATENCY];
+    frame.pending = !frame.samples.empty();
+    ++_frameIndex;
+    _inFrame = false;
+}
+
+void GpuProfiler::begin(const std::string& name)
+{
+    Frame& frame = _frames[_frameIndex % FRAME_LATENCY];
+    if (!_inFrame || frame.samples.size() == MAX_SCOPES) {
+        _stack.push_back(-1);
+        return;
+    }
+
+    auto index = _scopeIndices.find(name);
+    if (index == _scopeIndices.end()) {
+        index = _scopeIndices.emplace(name, (uint32_t)_scopes.size()).first;
+        _scopes.push_back({name, (uint32_t)_stack.size(), TimeHistory()});
+    }
+
+    // Elapsed queries can't nest
+    bool timed = _timestamps || _stack.empty();
+    bool stats = _pipelineStats && !_statsOpen;
+    int32_t sample = (int32_t)frame.samples.size();
+    frame.samples.push_back({index->second, timed, _stack.empty(), stats});
+    _stack.push_back(sample);
+    if (stats) {
+        for (uint32_t t = 0; t < STAT_TARGETS; ++t) {
+            if (_statTargets[t] != 0)
+                glBeginQuery(_statTargets[t], frame.statQueries[STAT_TARGETS * sample + t]);
+        }
+        _statsOpen = true;
+    }
+    if (!timed)
+        return;
+    if (_timestamps)
+        glQueryCounter(frame.queries[2 * sample], GL_TIMESTAMP);
+    else
+        glBeginQuery(GL_TIME_ELAPSED, frame.queries[2 * sample]);
+}
+
+void GpuProfiler::end()
+{
+    if (_stack.empty()) {
+        ADD_LOG("[profiler] Scope ended without a begin\n");
+        return;
+    }
+    int32_t sample = _stack.back();
+    _stack.pop_back();
+    Frame& frame = _frames[_frameIndex % FRAME_LATENCY];
+    if (sample < 0)
+        return;
+    if (frame.samples[sample].stats) {
+        for (GLenum target : _statTargets) {
+            if (target != 0)
+                glEndQuery(target);
+        }
+        _statsOpen = false;
+    }
+    if (!frame.samples[sample].timed)
+        return;
+    if (_timestamps)
+        glQueryCounter(frame.queries[2 * sample + 1], GL_TIMESTAMP);
+    else
+        glEndQuery(GL_TIME_ELAPSED);
+}
+
+const std::vector<GpuProfiler::Scope>& GpuProfiler::scopes() const
+{
+    return _scopes;
+}
+
+float GpuProfiler::average(const std::string& name, uint32_t frames) const
+{
+    auto index = _scopeIndices.find(name);
+    if (index == _scopeIndices.end())
+        return 0.f;
+    return _scopes[index->second].times.average(frames);
+}
+
+uint32_t GpuProfiler::droppedFrames() const
+{
+    return _dropped;
+}
+
+void GpuProfiler::setPipelineStats(bool enabled)
+{
+    _pipelineStats = enabled;
+}
+
+bool GpuProfiler::pipelineStats() const
+{
+    return _pipelineStats;
+}
+
+bool GpuProfiler::fullPipelineStats() const
+{
+    return _statTargets[0] != 0;
+}
+
+void GpuProfiler::calibrate()
+{
+    if (!_timestamps || !TraceRecorder::instance().recording()) {
+        _calibrated = false;
+        return;
+    }
+    if (_calibrated && _frameIndex - _calibrationFrame < CALIBRATION_INTERVAL)
+        return;
+
+    // Doesn't wait for the gpu, the counter is read as commands reach it
+    GLint64 gpuTime = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+    _clockOffset = gpuTime - (int64_t)CpuProfiler::instance().now();
+    _calibrated = true;
+    _calibrationFrame = _frameIndex;
+}
+
+bool GpuProfiler::collect(Frame& frame)
+{
+    auto available = [](GLuint query) {
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        return available != GL_FALSE;
+    };
+    uint32_t queryCount = _timestamps ? 2 : 1;
+    for (size_t i = 0; i < frame.samples.size(); ++i) {
+        const Sample& sample = frame.samples[i];
+        for (uint32_t q = 0; sample.timed && q < queryCount; ++q) {
+            if (!available(frame.queries[2 * i + q]))
+                return false;
+        }
+        for (uint32_t t = 0; sample.stats && t < STAT_TARGETS; ++t) {
+            if (_statTargets[t] != 0 && !available(frame.statQueries[STAT_TARGETS * i + t]))
+                return false;
+        }
+    }
+
+    // Scopes opened more than once in a frame are summed
+    std::vector<float> times(_scopes.size(), -1.f);
+    TraceRecorder& trace = TraceRecorder::instance();
+    // Without timestamps intervals are laid out back to back from the frame's start
+    uint64_t cursor = frame.cpuStart;
+    float frameTime = 0.f;
+    std::vector<PipelineStats> stats(_scopes.size());
+    std::vector<bool> hasStats(_scopes.size(), false);
+    for (size_t i = 0; i < frame.samples.size(); ++i) {
+        const Sample& sample = frame.samples[i];
+        if (sample.stats) {
+            GLuint64 counts[STAT_TARGETS] = {};
+            for (uint32_t t = 0; t < STAT_TARGETS; ++t) {
+                if (_statTargets[t] != 0)
+                    glGetQueryObjectui64v(frame.statQueries[STAT_TARGETS * i + t], GL_QUERY_RESULT,
+                                          &counts[t]);
+            }
+            PipelineStats& s = stats[sample.scope];
+            s.fragments += counts[0];
+            s.primitives += counts[1];
+            s.samples += counts[2];
+            hasStats[sample.scope] = true;
+        }
+        if (!sample.timed)
+            continue;
+        GLuint64 elapsed = 0;
+        if (_timestamps) {
+            GLuint64 start = 0;
+            glGetQueryObjectui64v(frame.queries[2 * i], GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(frame.queries[2 * i + 1], GL_QUERY_RESULT, &elapsed);
+            elapsed -= start;
+            if (trace.recording()) {
+                uint64_t cpuStart = (uint64_t)std::max((int64_t)start - _clockOffset, (int64_t)0);
+                trace.addGpu(_scopes[sample.scope].name, cpuStart, cpuStart + elapsed, true);
+            }
+        } else {
+            glGetQueryObjectui64v(frame.queries[2 * i], GL_QUERY_RESULT, &elapsed);
+            if (trace.recording())
+                trace.addGpu(_scopes[sample.scope].name, cursor, cursor + elapsed, false);
+            cursor += elapsed;
+        }
+        times[sample.scope] = std::max(times[sample.scope], 0.f) + elapsed * 0.000001f;
+        if (sample.root)
+            frameTime += elapsed * 0.000001f;
+    }
+    if (!frame.samples.empty())
+        FrameStats::instance().addGpuFrame(frameTime);
+    for (size_t i = 0; i < times.size(); ++i) {
+        if (times[i] >= 0.f)
+            _scopes[i].times.push(times[i]);
+        if (hasStats[i]) {
+            _scopes[i].hasStats = true;
+            _scopes[i].stats = stats[i];
+        }
+    }
+    frame.pending = false;
+    return true;
 }
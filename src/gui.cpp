@@ -1,32 +1,83 @@
 #include "gui.hpp"
 
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
 
+#include "abTest.hpp"
+#include "frameStats.hpp"
+#include "heatmap.hpp"
 #include "log.hpp"
 
 namespace {
     float LOGW = 690.f;
     float LOGH = 210.f;
     float LOGM = 10.f;
+    const int HISTOGRAM_BINS = 32;
 
     inline void uniformOffset()
     {
         ImGui::SetCursorPosX(ImGui::GetCursorPosX() + 27.f);
     }
+
+    struct ScopeRow {
+        const std::string* name;
+        uint32_t depth;
+        float ms;
+    };
+
+    // Rows are listed with children right after their parent
+    void drawScopeTree(const std::vector<ScopeRow>& rows)
+    {
+        // Tree levels pushed so far, rows deeper than a collapsed node are skipped
+        uint32_t open = 0;
+        uint32_t collapsedDepth = UINT32_MAX;
+        for (size_t i = 0; i < rows.size(); ++i) {
+            const ScopeRow& row = rows[i];
+            if (row.depth > collapsedDepth)
+                continue;
+            collapsedDepth = UINT32_MAX;
+            for (; open > row.depth; --open)
+                ImGui::TreePop();
+
+            bool parent = i + 1 < rows.size() && rows[i + 1].depth > row.depth;
+            ImGuiTreeNodeFlags flags = ImGuiTreeNodeFlags_DefaultOpen;
+            if (!parent)
+                flags |= ImGuiTreeNodeFlags_Leaf | ImGuiTreeNodeFlags_NoTreePushOnOpen;
+            // Names are unique among siblings
+            bool expanded = ImGui::TreeNodeEx(row.name->c_str(), flags, "%s: %.1f",
+                                              row.name->c_str(), row.ms);
+            if (parent && expanded)
+                open = row.depth + 1;
+            else if (parent)
+                collapsedDepth = row.depth;
+        }
+        for (; open > 0; --open)
+            ImGui::TreePop();
+    }
 }
 
 GUI::GUI() :
+    _window(nullptr),
     _useSliderTime(false),
-    _sliderTime(0.f)
+    _sliderTime(0.f),
+    _freezeUniforms(false),
+    _heatmap(false),
+    _abDefine{},
+    _abTime(0.f),
+    _abSamples(400)
 { }
 
 void GUI::init(GLFWwindow* window)
 {
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
-    ImGui_ImplGlfw_InitForOpenGL(window, false);
+    _window = window;
+    if (_window != nullptr)
+        ImGui_ImplGlfw_InitForOpenGL(window, false);
     ImGui_ImplOpenGL3_Init("#version 410");
     ImGui::StyleColorsDark();
 }
@@ -34,7 +85,8 @@ void GUI::init(GLFWwindow* window)
 void GUI::destroy()
 {
     ImGui_ImplOpenGL3_Shutdown();
-    ImGui_ImplGlfw_Shutdown();
+    if (_window != nullptr)
+        ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
 }
 
@@ -48,11 +100,17 @@ float GUI::sliderTime() const
     return _sliderTime;
 }
 
-void GUI::startFrame(
-    int windowHeight,
-    std::unordered_map<std::string, Uniform>& uniforms,
-    const std::vector<std::pair<std::string, const GpuProfiler*>>& timers
-)
+bool GUI::freezeUniforms() const
+{
+    return _freezeUniforms;
+}
+
+bool GUI::heatmap() const
+{
+    return _heatmap;
+}
+
+void GUI::startFrame(int windowHeight, std::unordered_map<std::string, Uniform>& uniforms)
 {
     // Start ImGui frame
     ImGui_ImplOpenGL3_NewFrame();
@@ -66,6 +124,7 @@ void GUI::startFrame(
     ImGui::Begin("Uniform Editor");
     ImGui::Checkbox("##Use slider time", &_useSliderTime);
     ImGui::SameLine(); ImGui::DragFloat("uTime", &_sliderTime, 0.01f);
+    ImGui::Checkbox("Freeze idle uniforms", &_freezeUniforms);
     for (auto& e : uniforms) {
         std::string name = e.first;
         Uniform& uniform = e.second;
@@ -93,19 +152,174 @@ void GUI::startFrame(
     }
     ImGui::End();
 
+    frameStats();
+    profiler();
+
     // Log
     ImGui::SetNextWindowSize(ImVec2(LOGW, LOGH), ImGuiSetCond_Always);
     ImGui::SetNextWindowPos(ImVec2(LOGM, windowHeight - LOGH - LOGM), ImGuiSetCond_Always);
     ImGui::Begin("Log", nullptr, ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoResize);
     ImGui::Text("Frame: %.1f", 1000.f / ImGui::GetIO().Framerate);
-    for (auto& t : timers) {
-        ImGui::SameLine(); ImGui::Text("%s: %.1f", t.first.c_str(), t.second->getAvg());
-    }
+    UniformStats& uniformStats = UniformStats::frame();
+    ImGui::SameLine();
+    ImGui::Text("Uniforms: %u sent, %u skipped", uniformStats.uploaded, uniformStats.skipped);
+    uniformStats = UniformStats();
     GUILog::draw();
 
     ImGui::End();
 }
 
+void GUI::profiler()
+{
+    ImGui::SetNextWindowPos(ImVec2(730, 10), ImGuiSetCond_Once);
+    ImGui::SetNextWindowSize(ImVec2(300, 400), ImGuiSetCond_Once);
+    if (!ImGui::Begin("Profiler")) {
+        ImGui::End();
+        return;
+    }
+
+    // Averages of the last 5 frames in ms, gpu scopes in the order they were first seen
+    std::vector<ScopeRow> rows;
+    for (auto& s : GpuProfiler::instance().scopes())
+        rows.push_back({&s.name, s.depth, s.times.average(5)});
+    if (ImGui::TreeNodeEx("GPU", ImGuiTreeNodeFlags_DefaultOpen)) {
+        drawScopeTree(rows);
+        ImGui::TreePop();
+    }
+
+    // One tree per thread
+    const CpuProfiler& cpuProfiler = CpuProfiler::instance();
+    const std::vector<uint32_t>& order = cpuProfiler.displayOrder();
+    for (size_t i = 0; i < order.size();) {
+        uint32_t thread = cpuProfiler.scopes()[order[i]].thread;
+        rows.clear();
+        for (; i < order.size() && cpuProfiler.scopes()[order[i]].thread == thread; ++i) {
+            const CpuProfiler::Scope& s = cpuProfiler.scopes()[order[i]];
+            rows.push_back({&s.name, s.depth, s.times.average(5)});
+        }
+        ImGui::PushID((int)thread);
+        if (ImGui::TreeNodeEx("##thread", ImGuiTreeNodeFlags_DefaultOpen, "%s",
+                              cpuProfiler.threadName(thread).c_str())) {
+            drawScopeTree(rows);
+            ImGui::TreePop();
+        }
+        ImGui::PopID();
+    }
+    ImGui::End();
+}
+
+void GUI::frameStats()
+{
+    ImGui::SetNextWindowPos(ImVec2(320, 10), ImGuiSetCond_Once);
+    ImGui::SetNextWindowSize(ImVec2(400, 600), ImGuiSetCond_Once);
+    ImGui::SetNextWindowCollapsed(true, ImGuiSetCond_Once);
+    // Skip the sorting while collapsed
+    if (!ImGui::Begin("Frame Stats")) {
+        ImGui::End();
+        return;
+    }
+
+    FrameStats& stats = FrameStats::instance();
+    float budget = stats.budget();
+    if (ImGui::DragFloat("Budget (ms)", &budget, 0.1f, 1.f, 100.f))
+        stats.setBudget(budget);
+    ImGui::Text("Hitches: %u", stats.hitches());
+
+    // Graphs are scaled so the budget is in the middle
+    float maxMs = 2.f * budget;
+    std::vector<float> values;
+    std::vector<float> bins(HISTOGRAM_BINS);
+    auto drawTimes = [&](const char* name, const FrameStats::History& times) {
+        FrameStats::Summary s = FrameStats::summarize(times);
+        ImGui::Separator();
+        ImGui::Text("%s p50: %.1f p95: %.1f p99: %.1f max: %.1f", name, s.p50, s.p95, s.p99,
+                    s.max);
+        values.resize(times.size());
+        for (uint32_t i = 0; i < times.size(); ++i)
+            values[i] = times[i];
+        ImGui::PushID(name);
+        ImGui::PlotLines("##times", values.data(), (int)values.size(), 0, nullptr, 0.f, maxMs,
+                         ImVec2(380, 60));
+        FrameStats::histogram(times, maxMs, bins);
+        ImGui::PlotHistogram("##histogram", bins.data(), (int)bins.size(), 0, "0 - 2x budget",
+                             0.f, 3.4e38f, ImVec2(380, 40));
+        ImGui::PopID();
+    };
+    drawTimes("CPU", stats.cpuTimes());
+    drawTimes("GPU", stats.gpuTimes());
+
+    // Counters of the latest frame read back
+    ImGui::Separator();
+    GpuProfiler& gpuProfiler = GpuProfiler::instance();
+    bool pipelineStats = gpuProfiler.pipelineStats();
+    if (ImGui::Checkbox("Pipeline statistics", &pipelineStats))
+        gpuProfiler.setPipelineStats(pipelineStats);
+    for (auto& s : gpuProfiler.scopes()) {
+        if (!pipelineStats || !s.hasStats)
+            continue;
+        if (gpuProfiler.fullPipelineStats())
+            ImGui::Text("%s: %" PRIu64 " fragments, %" PRIu64 " primitives, %" PRIu64 " samples",
+                        s.name.c_str(), s.stats.fragments, s.stats.primitives, s.stats.samples);
+        else
+            ImGui::Text("%s: %" PRIu64 " samples", s.name.c_str(), s.stats.samples);
+    }
+
+    // Loop iterations per pixel of the scene
+    ImGui::Separator();
+    ImGui::Checkbox("Step heatmap", &_heatmap);
+    if (_heatmap) {
+        Heatmap& heatmap = Heatmap::instance();
+        float scale = heatmap.scale();
+        if (ImGui::DragFloat("Red at steps", &scale, 1.f, 1.f, 4096.f))
+            heatmap.setScale(scale);
+        const Heatmap::Stats& h = heatmap.stats();
+        ImGui::Text("Steps: %" PRIu64 " total, %.1f average, %u max", h.totalSteps, h.average,
+                    h.max);
+        for (auto& tile : h.hottest)
+            ImGui::Text("Tile (%u, %u): %.1f", tile.x, tile.y, tile.average);
+    }
+
+    abTest();
+    ImGui::End();
+}
+
+void GUI::abTest()
+{
+    ImGui::Separator();
+    ABTest& test = ABTest::instance();
+    ImGui::InputText("B toggles define", _abDefine, sizeof(_abDefine));
+    ImGui::DragFloat("At uTime", &_abTime, 0.01f);
+    ImGui::InputInt("Samples per side", &_abSamples);
+    if (test.running()) {
+        if (ImGui::Button("Stop A/B"))
+            test.stop();
+    } else if (ImGui::Button("Start A/B") && test.shader() != nullptr) {
+        std::string define(_abDefine);
+        size_t split = define.find(' ');
+        std::string name = define.substr(0, split);
+        std::string value = split == std::string::npos ? "" : define.substr(split + 1);
+
+        // A is what's bound now, B adds the define or drops it if A has it
+        Shader* shader = test.shader();
+        Shader::Defines a = shader->defines();
+        a.erase(Heatmap::DEFINE);
+        Shader::Defines b = a;
+        if (b.erase(name) == 0 && !name.empty())
+            b[name] = value;
+        _heatmap = false;
+        test.start({shader, a}, {shader, b}, _abTime, (uint32_t)std::max(_abSamples, 2));
+    }
+    ImGui::SameLine(); ImGui::Text("%s", test.status().c_str());
+    if (test.hasResult()) {
+        const ABTest::Result& r = test.result();
+        ImGui::Text("A: %.3f ms, B: %.3f ms", r.meanA, r.meanB);
+        ImGui::Text("B - A: %+.3f ms +- %.3f ms", r.difference, r.confidence95);
+        if (r.rmse >= 0.f)
+            ImGui::Text("Image rmse %.2f, max %u, %.2f%% pixels differ", r.rmse, r.maxDifference,
+                        100.f * r.differingPixels);
+    }
+}
+
 void GUI::endFrame()
 {
     ImGui::Render();
@@ -0,0 +1,255 @@
+#include "headlessContext.hpp"
+
+#include <cstdio>
+#include <cstring>
+#ifdef SKUNKWORK_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif // SKUNKWORK_EGL
+
+namespace {
+#ifdef SKUNKWORK_EGL
+    bool hasExtension(const char* extensions, const char* name)
+    {
+        if (extensions == nullptr)
+            return false;
+        // Names are separated by spaces and can be prefixes of each other
+        size_t length = strlen(name);
+        for (const char* s = strstr(extensions, name); s != nullptr; s = strstr(s + length, name)) {
+            if ((s == extensions || s[-1] == ' ') && (s[length] == ' ' || s[length] == '\0'))
+                return true;
+        }
+        return false;
+    }
+
+    EGLDisplay getDisplay()
+    {
+        const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+        auto getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay != nullptr) {
+            // Picks the gpu without a display server, Mesa also lists llvmpipe as a device
+            if (hasExtension(clientExtensions, "EGL_EXT_platform_device")) {
+                auto queryDevices =
+                    (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+                EGLDeviceEXT device;
+                EGLint count = 0;
+                if (queryDevices != nullptr && queryDevices(1, &device, &count) && count > 0) {
+                    EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, device,
+                                                            nullptr);
+                    if (display != EGL_NO_DISPLAY)
+                        return display;
+                }
+            }
+            if (hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+                EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                                                        EGL_DEFAULT_DISPLAY, nullptr);
+                if (display != EGL_NO_DISPLAY)
+                    return display;
+            }
+        }
+        return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+#endif // SKUNKWORK_EGL
+}
+
+HeadlessContext::HeadlessContext() :
+    _major(0),
+    _minor(0),
+    _display(nullptr),
+    _config(nullptr),
+    _context(nullptr),
+    _surface(nullptr),
+    _surfaceless(false)
+{ }
+
+HeadlessContext::HeadlessContext(HeadlessContext&& other) :
+    _major(other._major),
+    _minor(other._minor),
+    _display(other._display),
+    _config(other._config),
+    _context(other._context),
+    _surface(other._surface),
+    _surfaceless(other._surfaceless)
+{
+    other._display = nullptr;
+    other._config = nullptr;
+    other._context = nullptr;
+    other._surface = nullptr;
+}
+
+bool HeadlessContext::init(int major, int minor)
+{
+#ifdef SKUNKWORK_EGL
+    _major = major;
+    _minor = minor;
+
+    EGLDisplay display = getDisplay();
+    EGLint eglMajor = 0;
+    EGLint eglMinor = 0;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &eglMajor, &eglMinor)) {
+        fprintf(stderr, "Error initializing EGL!\n");
+        fprintf(stderr, "Code: 0x%x\n", eglGetError());
+        return false;
+    }
+    _display = display;
+
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        fprintf(stderr, "EGL %d.%d doesn't support desktop GL\n", eglMajor, eglMinor);
+        destroy();
+        return false;
+    }
+
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_NONE
+    };
+    EGLConfig config = nullptr;
+    EGLint count = 0;
+    if (!eglChooseConfig(display, configAttribs, &config, 1, &count) || count == 0) {
+        fprintf(stderr, "No suitable EGL config\n");
+        destroy();
+        return false;
+    }
+    _config = config;
+
+    _context = createContext(EGL_NO_CONTEXT);
+    if (_context == EGL_NO_CONTEXT) {
+        fprintf(stderr, "Error creating a GL %d.%d core context through EGL!\n", major, minor);
+        fprintf(stderr, "Code: 0x%x\n", eglGetError());
+        destroy();
+        return false;
+    }
+
+    _surfaceless = hasExtension(eglQueryString(display, EGL_EXTENSIONS),
+                                "EGL_KHR_surfaceless_context");
+    if (!_surfaceless) {
+        _surface = createSurface();
+        if (_surface == EGL_NO_SURFACE) {
+            fprintf(stderr, "Error creating an EGL pbuffer\n");
+            destroy();
+            return false;
+        }
+    }
+
+    if (!eglMakeCurrent(display, _surface, _surface, _context)) {
+        fprintf(stderr, "Error making the EGL context current\n");
+        destroy();
+        return false;
+    }
+    return true;
+#else
+    (void) major;
+    (void) minor;
+    fprintf(stderr, "Built without EGL, configure with SKUNKWORK_EGL for headless runs\n");
+    return false;
+#endif // SKUNKWORK_EGL
+}
+
+void HeadlessContext::destroy()
+{
+#ifdef SKUNKWORK_EGL
+    if (_display == nullptr)
+        return;
+    eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (_surface != nullptr)
+        eglDestroySurface(_display, _surface);
+    if (_context != nullptr)
+        eglDestroyContext(_display, _context);
+    eglTerminate(_display);
+    eglReleaseThread();
+#endif // SKUNKWORK_EGL
+    _display = nullptr;
+    _config = nullptr;
+    _context = nullptr;
+    _surface = nullptr;
+}
+
+HeadlessContext::Shared HeadlessContext::createShared() const
+{
+    Shared shared;
+#ifdef SKUNKWORK_EGL
+    shared.context = createContext(_context);
+    if (shared.context != EGL_NO_CONTEXT && !_surfaceless) {
+        shared.surface = createSurface();
+        if (shared.surface == EGL_NO_SURFACE) {
+            eglDestroyContext(_display, shared.context);
+            shared.context = nullptr;
+        }
+    }
+#endif // SKUNKWORK_EGL
+    return shared;
+}
+
+void HeadlessContext::destroyShared(Shared& shared) const
+{
+#ifdef SKUNKWORK_EGL
+    if (shared.surface != nullptr)
+        eglDestroySurface(_display, shared.surface);
+    if (shared.context != nullptr)
+        eglDestroyContext(_display, shared.context);
+#endif // SKUNKWORK_EGL
+    shared.surface = nullptr;
+    shared.context = nullptr;
+}
+
+bool HeadlessContext::makeCurrent(const Shared& shared) const
+{
+#ifdef SKUNKWORK_EGL
+    // The bound api is per thread
+    eglBindAPI(EGL_OPENGL_API);
+    return eglMakeCurrent(_display, shared.surface, shared.surface, shared.context) == EGL_TRUE;
+#else
+    (void) shared;
+    return false;
+#endif // SKUNKWORK_EGL
+}
+
+void HeadlessContext::releaseCurrent() const
+{
+#ifdef SKUNKWORK_EGL
+    eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglReleaseThread();
+#endif // SKUNKWORK_EGL
+}
+
+bool HeadlessContext::surfaceless() const
+{
+    return _surfaceless;
+}
+
+void* HeadlessContext::createContext(void* share) const
+{
+#ifdef SKUNKWORK_EGL
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION_KHR, _major,
+        EGL_CONTEXT_MINOR_VERSION_KHR, _minor,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+        EGL_NONE
+    };
+    return eglCreateContext(_display, _config, share, contextAttribs);
+#else
+    (void) share;
+    return nullptr;
+#endif // SKUNKWORK_EGL
+}
+
+void* HeadlessContext::createSurface() const
+{
+#ifdef SKUNKWORK_EGL
+    // Only needed to make the context current, everything is drawn to framebuffer objects
+    const EGLint surfaceAttribs[] = {
+        EGL_WIDTH, 1,
+        EGL_HEIGHT, 1,
+        EGL_NONE
+    };
+    return eglCreatePbufferSurface(_display, _config, surfaceAttribs);
+#else
+    return nullptr;
+#endif // SKUNKWORK_EGL
+}
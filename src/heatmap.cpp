@@ -0,0 +1,328 @@
+#include "heatmap.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <string>
+
+#include "log.hpp"
+
+namespace {
+    const GLuint64 NO_WAIT = 0;
+
+    // Declared after #version and any extensions, the count goes to the second attachment
+    const char* PRELUDE =
+        "int _hmSteps = 0;\n"
+        "layout(location = 1) out float _hmOut;\n";
+    // The original main is renamed so the count is written after it returns
+    const char* EPILOGUE =
+        "void main()\n"
+        "{\n"
+        "    _hmMain();\n"
+        "    _hmOut = float(_hmSteps);\n"
+        "}\n";
+
+    const char* OVERLAY_VERT =
+        "#version 410\n"
+        "layout(location = 0) in vec3 pos;\n"
+        "out vec2 uv;\n"
+        "void main()\n"
+        "{\n"
+        "    uv = pos.xy * 0.5 + 0.5;\n"
+        "    gl_Position = vec4(pos, 1);\n"
+        "}\n";
+    const char* OVERLAY_FRAG =
+        "#version 410\n"
+        "uniform sampler2D uScene;\n"
+        "uniform sampler2D uSteps;\n"
+        "uniform float uScale;\n"
+        "in vec2 uv;\n"
+        "out vec4 fragColor;\n"
+        "void main()\n"
+        "{\n"
+        "    float heat = clamp(texture(uSteps, uv).r / uScale, 0, 1);\n"
+        "    // Blue through green and yellow to red\n"
+        "    vec3 ramp = clamp(vec3(2 * heat - 0.5, 2 - abs(4 * heat - 2), 1.5 - 3 * heat), 0, 1);\n"
+        "    vec3 scene = texture(uScene, uv).rgb;\n"
+        "    fragColor = vec4(mix(scene, ramp, heat > 0 ? 0.7 : 0), 1);\n"
+        "}\n";
+
+    bool isIdentChar(char c)
+    {
+        return std::isalnum((unsigned char)c) || c == '_';
+    }
+
+    GLuint compileStage(GLenum type, const char* source)
+    {
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &source, nullptr);
+        glCompileShader(shader);
+        GLint compiled = GL_FALSE;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+        if (compiled == GL_FALSE) {
+            char log[512];
+            glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+            ADD_LOG("[heatmap] Overlay compile failed: %s\n", log);
+        }
+        return shader;
+    }
+}
+
+Heatmap& Heatmap::instance()
+{
+    static Heatmap heatmap;
+    return heatmap;
+}
+
+Heatmap::Heatmap() :
+    _initialized(false),
+    _width(0),
+    _height(0),
+    _program(0),
+    _sceneLocation(-1),
+    _stepsLocation(-1),
+    _scaleLocation(-1),
+    _scale(64.f),
+    _pbo(0),
+    _fence(nullptr),
+    _readWidth(0),
+    _readHeight(0)
+{ }
+
+size_t Heatmap::instrument(ShaderSource& source)
+{
+    size_t loops = 0;
+    bool renamedMain = false;
+    // Set when a loop header ends its line, the body brace is expected next
+    bool pendingBody = false;
+    source.replaceLines([&](std::string_view line, std::string& replacement) {
+        std::string_view code = line.substr(0, line.find("//"));
+        std::string out;
+        size_t copied = 0;
+        auto insertAfter = [&](size_t pos, const char* text) {
+            out.append(code.substr(copied, pos + 1 - copied));
+            out += text;
+            copied = pos + 1;
+        };
+
+        if (pendingBody) {
+            pendingBody = false;
+            size_t first = code.find_first_not_of(" \t\r");
+            if (first != std::string_view::npos && code[first] == '{') {
+                insertAfter(first, " _hmSteps++;");
+                ++loops;
+            }
+        }
+
+        std::string_view previous;
+        for (size_t i = 0; i < code.size();) {
+            if (!isIdentChar(code[i])) {
+                ++i;
+                continue;
+            }
+            size_t start = i;
+            while (i < code.size() && isIdentChar(code[i]))
+                ++i;
+            std::string_view ident = code.substr(start, i - start);
+
+            if (ident == "main" && previous == "void" && !renamedMain) {
+                out.append(code.substr(copied, start - copied));
+                out += "_hmMain";
+                copied = i;
+                renamedMain = true;
+            } else if (ident == "for" || ident == "while") {
+                size_t open = code.find_first_not_of(" \t", i);
+                if (open == std::string_view::npos || code[open] != '(')
+                    continue;
+                int depth = 0;
+                size_t close = open;
+                for (; close < code.size(); ++close) {
+                    depth += code[close] == '(' ? 1 : code[close] == ')' ? -1 : 0;
+                    if (depth == 0)
+                        break;
+                }
+                if (close == code.size())
+                    continue;
+                size_t body = code.find_first_not_of(" \t\r", close + 1);
+                if (body == std::string_view::npos) {
+                    pendingBody = true;
+                } else if (code[body] == '{') {
+                    insertAfter(body, " _hmSteps++;");
+                    ++loops;
+                    i = body + 1;
+                }
+            }
+            previous = ident;
+        }
+
+        if (copied == 0)
+            return false;
+        out.append(line.substr(copied));
+        replacement = std::move(out);
+        return true;
+    });
+
+    if (!renamedMain) {
+        ADD_LOG("[heatmap] No main found to instrument\n");
+        return loops;
+    }
+    int32_t file = source.pathIndex("<heatmap>");
+    source.insertAfterExtensions(PRELUDE, {file, 0});
+    source.append(std::string("\n") + EPILOGUE, {file, 0});
+    return loops;
+}
+
+void Heatmap::init()
+{
+    GLuint vert = compileStage(GL_VERTEX_SHADER, OVERLAY_VERT);
+    GLuint frag = compileStage(GL_FRAGMENT_SHADER, OVERLAY_FRAG);
+    _program = glCreateProgram();
+    glAttachShader(_program, vert);
+    glAttachShader(_program, frag);
+    glLinkProgram(_program);
+    glDeleteShader(vert);
+    glDeleteShader(frag);
+    _sceneLocation = glGetUniformLocation(_program, "uScene");
+    _stepsLocation = glGetUniformLocation(_program, "uSteps");
+    _scaleLocation = glGetUniformLocation(_program, "uScale");
+    glGenBuffers(1, &_pbo);
+    _initialized = true;
+}
+
+void Heatmap::destroy()
+{
+    if (!_initialized)
+        return;
+    if (_fence != nullptr)
+        glDeleteSync(_fence);
+    _fence = nullptr;
+    glDeleteBuffers(1, &_pbo);
+    glDeleteProgram(_program);
+    _target.reset();
+    _width = 0;
+    _height = 0;
+    _initialized = false;
+}
+
+void Heatmap::begin(uint32_t width, uint32_t height)
+{
+    if (!_initialized)
+        init();
+
+    if (!_target) {
+        std::vector<TextureParams> params = {
+            {GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_NEAREST, GL_NEAREST, GL_CLAMP_TO_EDGE,
+             GL_CLAMP_TO_EDGE},
+            {GL_R32F, GL_RED, GL_FLOAT, GL_NEAREST, GL_NEAREST, GL_CLAMP_TO_EDGE,
+             GL_CLAMP_TO_EDGE}
+        };
+        _target.reset(new FrameBuffer(width, height, params));
+    } else if (width != _width || height != _height) {
+        _target->resize(width, height);
+    }
+    _width = width;
+    _height = height;
+
+    _target->bindWrite();
+    // Programs without the counter leave the steps as they are
+    const GLfloat zero[4] = {0.f, 0.f, 0.f, 0.f};
+    glClearBufferfv(GL_COLOR, 0, zero);
+    glClearBufferfv(GL_COLOR, 1, zero);
+}
+
+void Heatmap::end(const Quad& quad)
+{
+    finishReadback();
+    if (_fence == nullptr)
+        startReadback();
+
+    FrameBuffer::bindDefault(GL_DRAW_FRAMEBUFFER);
+    glUseProgram(_program);
+    _target->bindRead(0, GL_TEXTURE0, _sceneLocation);
+    _target->bindRead(1, GL_TEXTURE1, _stepsLocation);
+    glUniform1f(_scaleLocation, _scale);
+    quad.render();
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void Heatmap::setScale(float steps)
+{
+    _scale = std::max(steps, 1.f);
+}
+
+float Heatmap::scale() const
+{
+    return _scale;
+}
+
+const Heatmap::Stats& Heatmap::stats() const
+{
+    return _stats;
+}
+
+void Heatmap::startReadback()
+{
+    _readWidth = _width;
+    _readHeight = _height;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)_readWidth * _readHeight * sizeof(GLfloat),
+                 nullptr, GL_STREAM_READ);
+    _target->bindReadBuffer(1);
+    glReadPixels(0, 0, _readWidth, _readHeight, GL_RED, GL_FLOAT, nullptr);
+    FrameBuffer::bindDefault(GL_READ_FRAMEBUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    _fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void Heatmap::finishReadback()
+{
+    if (_fence == nullptr)
+        return;
+    GLenum status = glClientWaitSync(_fence, 0, NO_WAIT);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return;
+    glDeleteSync(_fence);
+    _fence = nullptr;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _pbo);
+    size_t size = (size_t)_readWidth * _readHeight * sizeof(GLfloat);
+    const GLfloat* steps =
+        (const GLfloat*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+    if (steps == nullptr) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return;
+    }
+
+    uint32_t tilesX = (_readWidth + TILE_SIZE - 1) / TILE_SIZE;
+    uint32_t tilesY = (_readHeight + TILE_SIZE - 1) / TILE_SIZE;
+    std::vector<uint64_t> tileSteps(tilesX * tilesY, 0);
+    Stats stats;
+    for (uint32_t y = 0; y < _readHeight; ++y) {
+        for (uint32_t x = 0; x < _readWidth; ++x) {
+            uint32_t s = (uint32_t)steps[y * _readWidth + x];
+            stats.totalSteps += s;
+            stats.max = std::max(stats.max, s);
+            tileSteps[(y / TILE_SIZE) * tilesX + x / TILE_SIZE] += s;
+        }
+    }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    if (_readWidth * _readHeight > 0)
+        stats.average = (float)stats.totalSteps / (_readWidth * _readHeight);
+    // Edge tiles are averaged over the pixels they actually cover
+    for (uint32_t ty = 0; ty < tilesY; ++ty) {
+        for (uint32_t tx = 0; tx < tilesX; ++tx) {
+            uint32_t w = std::min(TILE_SIZE, _readWidth - tx * TILE_SIZE);
+            uint32_t h = std::min(TILE_SIZE, _readHeight - ty * TILE_SIZE);
+            stats.hottest.push_back({tx, ty, (float)tileSteps[ty * tilesX + tx] / (w * h)});
+        }
+    }
+    size_t count = std::min(HOTTEST_TILES, stats.hottest.size());
+    std::partial_sort(stats.hottest.begin(), stats.hottest.begin() + count, stats.hottest.end(),
+                      [](const Tile& a, const Tile& b){ return a.average > b.average; });
+    stats.hottest.resize(count);
+    _stats = std::move(stats);
+}
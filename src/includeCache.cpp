@@ -0,0 +1,211 @@
+#include "includeCache.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <sys/stat.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif // _WIN32
+
+#include "log.hpp"
+#include "mappedFile.hpp"
+
+namespace {
+    enum class Guard {
+        Start,
+        Ifndef,
+        Body,
+        Closed,
+        None
+    };
+
+    std::string_view trimmed(std::string_view line) {
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string_view::npos)
+            return std::string_view();
+        size_t end = line.find_last_not_of(" \t\r");
+        return line.substr(start, end - start + 1);
+    }
+
+    // Splits "#name arg" into name and first word of arg
+    bool directive(std::string_view line, std::string_view& name, std::string_view& arg) {
+        if (line.empty() || line[0] != '#')
+            return false;
+        line = trimmed(line.substr(1));
+        size_t nameEnd = std::min(line.find_first_of(" \t"), line.size());
+        name = line.substr(0, nameEnd);
+        arg = trimmed(line.substr(nameEnd));
+        arg = arg.substr(0, std::min(arg.find_first_of(" \t"), arg.size()));
+        return true;
+    }
+
+    bool canonicalPath(const std::string& path, std::string& canonical) {
+#ifdef _WIN32
+        char resolved[_MAX_PATH];
+        if (_fullpath(resolved, path.c_str(), sizeof(resolved)) == nullptr)
+            return false;
+#else
+        char resolved[PATH_MAX];
+        if (realpath(path.c_str(), resolved) == nullptr)
+            return false;
+#endif // _WIN32
+        canonical = resolved;
+        return true;
+    }
+}
+
+IncludeCache& IncludeCache::instance()
+{
+    static IncludeCache cache;
+    return cache;
+}
+
+IncludeCache::IncludeCache() :
+    _hits(0),
+    _misses(0)
+{ }
+
+std::shared_ptr<const SourceFile> IncludeCache::get(const std::string& path)
+{
+    std::string canonical;
+    if (!canonicalPath(path, canonical))
+        return nullptr;
+
+    // Sub-second timestamps since consecutive saves can land within one second
+    Stamp stamp;
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(canonical.c_str(), GetFileExInfoStandard, &data))
+        return nullptr;
+    stamp.mtime = ((int64_t)data.ftLastWriteTime.dwHighDateTime << 32) |
+                  data.ftLastWriteTime.dwLowDateTime;
+    stamp.size = ((int64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    stamp.inode = 0;
+#else
+    struct stat sb;
+    if (stat(canonical.c_str(), &sb) == -1)
+        return nullptr;
+#ifdef __APPLE__
+    stamp.mtime = (int64_t)sb.st_mtimespec.tv_sec * 1000000000 + sb.st_mtimespec.tv_nsec;
+#else
+    stamp.mtime = (int64_t)sb.st_mtim.tv_sec * 1000000000 + sb.st_mtim.tv_nsec;
+#endif // __APPLE__
+    stamp.size = sb.st_size;
+    // Atomic saves replace the inode
+    stamp.inode = sb.st_ino;
+#endif // _WIN32
+
+    auto entry = _entries.find(canonical);
+    if (entry != _entries.end() && entry->second.stamp == stamp) {
+        ++_hits;
+        return entry->second.file;
+    }
+
+    ++_misses;
+    auto file = parse(canonical);
+    if (!file) {
+        _entries.erase(canonical);
+        return nullptr;
+    }
+    // Programs still holding the old version keep its text alive
+    _entries[canonical] = {stamp, file};
+    return file;
+}
+
+void IncludeCache::report()
+{
+    ADD_LOG("[include] %u hits, %u misses, %u files cached\n", _hits, _misses,
+            (uint32_t)_entries.size());
+    _hits = 0;
+    _misses = 0;
+}
+
+std::shared_ptr<const SourceFile> IncludeCache::parse(const std::string& path) const
+{
+    // Mapped only for the copy, so edits in place can't touch text that's in use
+    std::shared_ptr<SourceFile> file;
+    {
+        MappedFile mapped(path);
+        if (!mapped.isOpen())
+            return nullptr;
+        file = std::make_shared<SourceFile>(std::string(mapped.view()));
+    }
+    std::string_view text = file->text;
+
+    // Split at include lines, plain text stays as views into the copy
+    // Also look for a guard around the whole file, i.e. #ifndef X, #define X first
+    // and the matching #endif last with only comments outside
+    Guard guard = Guard::Start;
+    std::string_view guardMacro;
+    int depth = 0;
+    bool inComment = false;
+    size_t segStart = 0;
+    for (size_t lineStart = 0; lineStart < text.size();) {
+        size_t lineEnd = std::min(text.find('\n', lineStart), text.size());
+        size_t lineBegin = lineStart;
+        std::string_view line = trimmed(text.substr(lineStart, lineEnd - lineStart));
+        lineStart = lineEnd + 1;
+
+        // Comments don't break the guard
+        if (inComment) {
+            inComment = line.find("*/") == std::string_view::npos;
+            continue;
+        }
+        if (line.empty() || line.compare(0, 2, "//") == 0)
+            continue;
+        if (line.compare(0, 2, "/*") == 0) {
+            inComment = line.find("*/", 2) == std::string_view::npos;
+            continue;
+        }
+
+        std::string_view name;
+        std::string_view arg;
+        bool isDirective = directive(line, name, arg);
+        switch (guard) {
+        case Guard::Start:
+            guard = isDirective && name == "ifndef" ? Guard::Ifndef : Guard::None;
+            guardMacro = arg;
+            depth = 1;
+            break;
+        case Guard::Ifndef:
+            guard = isDirective && name == "define" && arg == guardMacro ? Guard::Body
+                                                                          : Guard::None;
+            break;
+        case Guard::Body:
+            if (isDirective && name.compare(0, 2, "if") == 0)
+                ++depth;
+            else if (isDirective && name == "endif" && --depth == 0)
+                guard = Guard::Closed;
+            break;
+        case Guard::Closed:
+            guard = Guard::None;
+            break;
+        default:
+            break;
+        }
+
+        if (isDirective && name == "include") {
+            // Expect correct syntax
+            size_t nameStart = line.find('"') + 1;
+            size_t nameEnd = line.find('"', nameStart);
+            file->pieces.push_back({text.substr(segStart, lineBegin - segStart),
+                                    std::string(line.substr(nameStart, nameEnd - nameStart))});
+            segStart = lineStart;
+        } else if (isDirective && name == "pragma" && arg == "once") {
+            // Not every driver knows the pragma, blank it to keep line numbers intact
+            file->once = true;
+            file->pieces.push_back({text.substr(segStart, lineBegin - segStart), ""});
+            file->pieces.push_back({"\n", ""});
+            segStart = lineStart;
+        }
+    }
+    file->once = file->once || guard == Guard::Closed;
+    if (segStart < text.size())
+        file->pieces.push_back({text.substr(segStart), ""});
+    if (!text.empty() && text.back() != '\n')
+        file->pieces.push_back({"\n", ""});
+
+    return file;
+}
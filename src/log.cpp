@@ -27,6 +27,7 @@ SOFTWARE.
 #include "log.hpp"
 
 #include <GL/gl3w.h>
+#include <cstdio>
 #include <imgui.h>
 
 Log& Log::instance()
@@ -48,12 +49,22 @@ void Log::addLog(const char* fmt, ...)
     va_start(args, fmt);
     _buf.appendfv(fmt, args);
     va_end(args);
+    if (_echo)
+        fputs(_buf.begin() + old_size, stderr);
     for (int new_size = _buf.size(); old_size < new_size; old_size++)
         if (_buf[old_size] == '\n')
             _lineOffsets.push_back(old_size);
     _scrollToBottom = true;
 }
 
+void Log::setEcho(bool echo)
+{
+    // Starts with what was logged so far
+    if (echo && !_echo)
+        fputs(_buf.begin(), stderr);
+    _echo = echo;
+}
+
 void Log::draw()
 {
     if (ImGui::Button("Clear")) clear();
@@ -90,7 +101,9 @@ void Log::draw()
     ImGui::EndChild();
 }
 
-Log::Log()
+Log::Log() :
+    _scrollToBottom(false),
+    _echo(false)
 {
     // Start log with GL context info
     addLog("[gl] Context: %s\n", glGetString(GL_VERSION));
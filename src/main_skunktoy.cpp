@@ -4,12 +4,25 @@
 #endif // _WIN32
 
 #include <GL/gl3w.h>
-
+#include <thread>
+
+#include "abTest.hpp"
+#include "commandLine.hpp"
+#include "cpuProfiler.hpp"
+#include "exportCoordinator.hpp"
+#include "exporter.hpp"
+#include "frameStats.hpp"
 #include "gpuProfiler.hpp"
 #include "gui.hpp"
+#include "heatmap.hpp"
+#include "log.hpp"
 #include "quad.hpp"
 #include "shader.hpp"
+#include "shaderCompiler.hpp"
+#include "shaderManager.hpp"
 #include "timer.hpp"
+#include "traceRecorder.hpp"
+#include "uniformBuffer.hpp"
 #include "window.hpp"
 
 #ifdef _WIN32
@@ -19,19 +32,35 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLin
     (void) hPrevInstance;
     (void) lpCmdLine;
     (void) nCmdShow;
+    int argc = __argc;
+    char** argv = __argv;
 #else
-int main()
+int main(int argc, char* argv[])
 {
 #endif // _WIN32
-    // Init GLFW-context
+    // Run headless, at another size or export frames with command line options
+    CommandLine options;
+    if (!options.parse(argc, argv))
+        return -1;
+
+    // Big exports are rendered by copies of this program, each with its own context
+    if (options.exporter.enabled() && options.exporter.workers > 1) {
+        ExportCoordinator coordinator(options, argv[0]);
+        exit(coordinator.run() ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    // Init GLFW-context, or an EGL one when headless
     Window window;
-    if (!window.init(1280, 720, "skunktoy"))
+    if (!window.init(options.window, "skunktoy"))
         return -1;
 
     // Setup imgui
     GUI gui;
     gui.init(window.ptr());
 
+    // Compile shaders without blocking the main loop
+    ShaderCompiler::instance().init(window);
+
     Quad q;
 
     // Set up scene
@@ -39,50 +68,141 @@ int main()
     vertPath += "shader/basic_vert.glsl";
     std::string fragPath(RES_DIRECTORY);
     fragPath += "shader/basic_frag.glsl";
-    Shader shader(vertPath, fragPath, "");
+    ShaderManager shaders;
+    Shader& shader = shaders.add(vertPath, fragPath, "");
+
+    // Engine uniforms are shared by all shaders through one block
+    UniformBuffer engine("Engine", 0);
+    shader.attachBlock(engine);
+    BlockHandle<GLfloat> uTime = engine.member<GLfloat>("uTime");
+    BlockHandle<GLfloat[2]> uRes = engine.member<GLfloat[2]>("uRes");
+    BlockHandle<GLfloat[2]> uMPos = engine.member<GLfloat[2]>("uMPos");
 
-    Timer reloadTime;
     Timer globalTime;
-    GpuProfiler sceneProf(5);
-    std::vector<std::pair<std::string, const GpuProfiler*>> profilers =
-        {{"Scene", &sceneProf}};
+    CpuProfiler& cpuProfiler = CpuProfiler::instance();
+    cpuProfiler.setThreadName("Main");
+    GpuProfiler& gpuProfiler = GpuProfiler::instance();
+    Heatmap& heatmap = Heatmap::instance();
+    const Shader::Defines heatmapDefines = {{Heatmap::DEFINE, ""}};
+    // Variants of a second shader loaded from other files could also be passed to start()
+    ABTest& abTest = ABTest::instance();
+    abTest.setShader(shader);
+    // Every frame is over budget when exporting or rendering in software
+    FrameStats::instance().setLogHitches(!window.headless() && !options.exporter.enabled());
+    // Steps time at a fixed rate and reads frames back instead of following the clock
+    Exporter& exporter = Exporter::instance();
+    if (options.exporter.enabled()) {
+        // Exported frames need the programs, the first ones would be missing otherwise
+        while (shaders.pending()) {
+            shaders.update();
+            std::this_thread::yield();
+        }
+        // Frames would come out blank
+        if (!shaders.linked()) {
+            ADD_LOG("[export] Shaders failed to build, not exporting\n");
+            return -1;
+        }
+        if (!exporter.start(options.exporter))
+            return -1;
+        // Frames are rendered as fast as they can be read back, not at the refresh rate
+        window.setVsync(false);
+    }
 
     // Run the main loop
     while (window.open()) {
+        cpuProfiler.startFrame();
+        CpuScope frameScope("Frame");
+
         window.startFrame();
+        gpuProfiler.startFrame();
+        bool exporting = exporter.running();
 
-        if (window.drawGUI())
-            gui.startFrame(window.height(), shader.dynamicUniforms(), profilers);
+        UniformStats::setEnabled(window.drawGUI());
+        if (window.drawGUI()) {
+            CpuScope scope("GUI");
+            gui.startFrame(window.height(), shader.dynamicUniforms());
+        }
 
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        // Try reloading the shader every 0.5s
-        if (reloadTime.getSeconds() > 0.5f) {
-            shader.reload();
-            reloadTime.reset();
+        // The test switches the variants itself, exports only draw the plain scene
+        bool abTesting = abTest.running() && !exporting;
+        bool showHeatmap = gui.heatmap() && !exporting;
+        shader.setFreezing(gui.freezeUniforms() && !abTesting);
+        if (!abTesting)
+            shader.setDefines(showHeatmap ? heatmapDefines : Shader::Defines());
+        {
+            // Reload shaders affected by source changes
+            CpuScope scope("Reload");
+            shaders.update();
         }
 
         // TODO: No need to reset before switch back
         if (gui.useSliderTime())
             globalTime.reset();
 
-        sceneProf.startSample();
-        shader.bind();
-        shader.setFloat(
-            "uTime",
-            gui.useSliderTime() ? gui.sliderTime() : globalTime.getSeconds()
-        );
-        shader.setVec2("uRes", (GLfloat)window.width(), (GLfloat)window.height());
-        q.render();
-        sceneProf.endSample();
-
-        if (window.drawGUI())
+        if (exporting)
+            uTime.set((GLfloat)exporter.time());
+        else if (abTesting)
+            uTime.set(abTest.time());
+        else
+            uTime.set(gui.useSliderTime() ? gui.sliderTime() : globalTime.getSeconds());
+        if (exporting)
+            uRes.set({(GLfloat)exporter.width(), (GLfloat)exporter.height()});
+        else
+            uRes.set({(GLfloat)window.width(), (GLfloat)window.height()});
+        // Exported and compared frames can't depend on where the cursor happens to be
+        if (exporting || abTesting)
+            uMPos.set({0.f, 0.f});
+        else
+            uMPos.set({window.cursorX(), window.cursorY()});
+        engine.upload();
+
+        if (abTesting) {
+            // Timed by the test, its elapsed queries can't nest inside the profiler's
+            CpuScope cpuScope("A/B");
+            Shader& side = abTest.startFrame();
+            side.bind();
+            q.render();
+            abTest.endFrame(window.width(), window.height());
+        } else {
+            // Specialized program with frozen uniforms is timed separately for comparison
+            CpuScope cpuScope("Draw");
+            GpuScope scope(shader.frozen() ? "Frozen" : "Scene");
+            if (exporting)
+                exporter.startFrame();
+            else if (showHeatmap)
+                heatmap.begin(window.width(), window.height());
+            shader.bind();
+            q.render();
+            if (exporting)
+                exporter.endFrame(window.width(), window.height());
+            else if (showHeatmap)
+                heatmap.end(q);
+        }
+
+        if (window.drawGUI()) {
+            CpuScope cpuScope("GUI");
+            GpuScope scope("GUI");
             gui.endFrame();
+        }
 
+        gpuProfiler.endFrame();
         window.endFrame();
+        if (exporter.finished())
+            window.close();
+        FrameStats::instance().endFrame();
     }
 
+    // Finish a trace that is still being recorded
+    TraceRecorder::instance().stop();
+    // Writes out what was rendered if the window was closed early
+    exporter.stop();
+    ShaderCompiler::instance().destroy();
+    gpuProfiler.destroy();
+    heatmap.destroy();
+    abTest.destroy();
     gui.destroy();
     window.destroy();
-    exit(EXIT_SUCCESS);
+    exit(!options.exporter.enabled() || exporter.complete() ? EXIT_SUCCESS : EXIT_FAILURE);
 }
@@ -0,0 +1,137 @@
+#include "mappedFile.hpp"
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif // _WIN32
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string& path) :
+    _data(nullptr),
+    _size(0),
+    _open(false),
+    _file(INVALID_HANDLE_VALUE),
+    _mapping(nullptr)
+{
+    _file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (_file == INVALID_HANDLE_VALUE)
+        return;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(_file, &size)) {
+        unmap();
+        return;
+    }
+    _size = (size_t)size.QuadPart;
+    _open = true;
+    // Empty files can't be mapped
+    if (_size == 0)
+        return;
+
+    _mapping = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (_mapping != nullptr)
+        _data = (const char*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (_data == nullptr)
+        unmap();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept :
+    _data(other._data),
+    _size(other._size),
+    _open(other._open),
+    _file(other._file),
+    _mapping(other._mapping)
+{
+    other._data = nullptr;
+    other._size = 0;
+    other._open = false;
+    other._file = INVALID_HANDLE_VALUE;
+    other._mapping = nullptr;
+}
+
+void MappedFile::unmap()
+{
+    if (_data != nullptr)
+        UnmapViewOfFile(_data);
+    if (_mapping != nullptr)
+        CloseHandle(_mapping);
+    if (_file != INVALID_HANDLE_VALUE)
+        CloseHandle(_file);
+    _data = nullptr;
+    _size = 0;
+    _open = false;
+    _file = INVALID_HANDLE_VALUE;
+    _mapping = nullptr;
+}
+#else
+MappedFile::MappedFile(const std::string& path) :
+    _data(nullptr),
+    _size(0),
+    _open(false)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return;
+
+    struct stat sb;
+    if (fstat(fd, &sb) == -1) {
+        close(fd);
+        return;
+    }
+    _size = sb.st_size;
+    _open = true;
+
+    // Empty files can't be mapped
+    if (_size > 0) {
+        void* data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            _size = 0;
+            _open = false;
+        } else {
+            _data = (const char*)data;
+        }
+    }
+    // The mapping stays valid without the descriptor
+    close(fd);
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept :
+    _data(other._data),
+    _size(other._size),
+    _open(other._open)
+{
+    other._data = nullptr;
+    other._size = 0;
+    other._open = false;
+}
+
+void MappedFile::unmap()
+{
+    if (_data != nullptr)
+        munmap((void*)_data, _size);
+    _data = nullptr;
+    _size = 0;
+    _open = false;
+}
+#endif // _WIN32
+
+MappedFile::~MappedFile()
+{
+    unmap();
+}
+
+bool MappedFile::isOpen() const
+{
+    return _open;
+}
+
+std::string_view MappedFile::view() const
+{
+    return std::string_view(_data, _size);
+}
@@ -0,0 +1,158 @@
+#include "programCache.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include "fileSystem.hpp"
+#include "log.hpp"
+
+namespace {
+    const char MAGIC[4] = {'S', 'K', 'P', 'B'};
+
+    struct BinaryHeader {
+        char magic[4];
+        GLenum format;
+        uint32_t length;
+    };
+
+    // 64-bit FNV-1a
+    uint64_t hash(uint64_t h, const char* data, size_t length) {
+        for (size_t i = 0; i < length; ++i) {
+            h ^= (uint8_t)data[i];
+            h *= 0x100000001b3ull;
+        }
+        return h;
+    }
+}
+
+ProgramCache& ProgramCache::instance()
+{
+    static ProgramCache cache;
+    return cache;
+}
+
+ProgramCache::ProgramCache() :
+    _supported(false),
+    _dirPath(CACHE_DIRECTORY),
+    _hits(0),
+    _misses(0)
+{
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if (formats == 0) {
+        ADD_LOG("[cache] Program binaries not supported by the driver\n");
+        return;
+    }
+    _supported = true;
+
+    // Binaries are only valid for the exact driver that produced them
+    _driver += (const char*)glGetString(GL_VENDOR);
+    _driver += '\n';
+    _driver += (const char*)glGetString(GL_RENDERER);
+    _driver += '\n';
+    _driver += (const char*)glGetString(GL_VERSION);
+
+    makeDir(_dirPath);
+}
+
+uint64_t ProgramCache::key(const std::vector<const ShaderSource*>& sources) const
+{
+    uint64_t h = hash(0xcbf29ce484222325ull, _driver.c_str(), _driver.size());
+    for (auto* source : sources) {
+        for (auto& s : source->segments)
+            h = hash(h, s.data(), s.size());
+        // Include a terminator to separate stages
+        h = hash(h, "", 1);
+    }
+    return h;
+}
+
+GLuint ProgramCache::load(uint64_t key)
+{
+    if (!_supported)
+        return 0;
+
+    std::ifstream file(path(key), std::ios::binary | std::ios::ate);
+    std::streamoff fileSize = file ? (std::streamoff)file.tellg() : 0;
+    BinaryHeader header;
+    if (!file || !file.seekg(0) || !file.read((char*)&header, sizeof(header)) ||
+        memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        ++_misses;
+        ADD_LOG("[cache] Miss (%u hits, %u misses)\n", _hits, _misses);
+        return 0;
+    }
+
+    // Don't trust the header of a damaged file with the allocation
+    std::vector<char> binary;
+    if (fileSize - (std::streamoff)sizeof(header) == header.length)
+        binary.resize(header.length);
+    if (binary.empty() || !file.read(binary.data(), binary.size())) {
+        ++_misses;
+        ADD_LOG("[cache] Truncated binary (%u hits, %u misses)\n", _hits, _misses);
+        return 0;
+    }
+
+    GLuint progID = glCreateProgram();
+    glProgramBinary(progID, header.format, binary.data(), binary.size());
+    GLint linked = GL_FALSE;
+    glGetProgramiv(progID, GL_LINK_STATUS, &linked);
+    if (linked == GL_FALSE) {
+        // Driver update or otherwise incompatible binary, fall back to compiling
+        glDeleteProgram(progID);
+        ++_misses;
+        ADD_LOG("[cache] Binary rejected (%u hits, %u misses)\n", _hits, _misses);
+        return 0;
+    }
+
+    ++_hits;
+    ADD_LOG("[cache] Hit (%u hits, %u misses)\n", _hits, _misses);
+    return progID;
+}
+
+void ProgramCache::store(uint64_t key, GLuint program)
+{
+    if (!_supported)
+        return;
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length == 0)
+        return;
+
+    BinaryHeader header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    std::vector<char> binary(length);
+    glGetProgramBinary(program, length, nullptr, &header.format, binary.data());
+    header.length = length;
+
+    // Other processes, like export workers, may be loading the same entry so it's
+    // written to a file of our own and renamed into place once complete
+    std::string finalPath = path(key);
+    std::string writePath = tempPath(finalPath);
+    {
+        std::ofstream file(writePath, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            ADD_LOG("[cache] Unable to write '%s'\n", writePath.c_str());
+            return;
+        }
+        file.write((const char*)&header, sizeof(header));
+        file.write(binary.data(), binary.size());
+        file.close();
+        if (!file) {
+            ADD_LOG("[cache] Unable to write '%s'\n", writePath.c_str());
+            remove(writePath.c_str());
+            return;
+        }
+    }
+    if (!replaceFile(writePath, finalPath))
+        ADD_LOG("[cache] Unable to move '%s' into place\n", writePath.c_str());
+}
+
+std::string ProgramCache::path(uint64_t key) const
+{
+    char name[21];
+    snprintf(name, sizeof(name), "%016" PRIx64 ".bin", key);
+    return _dirPath + name;
+}
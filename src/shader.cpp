@@ -1,23 +1,22 @@
 #include "shader.hpp"
 
-#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <cstring>
 #include <sstream>
-#include <stack>
-#include <sys/stat.h>
 
+#include "fileWatcher.hpp"
+#include "heatmap.hpp"
+#include "includeCache.hpp"
 #include "log.hpp"
+#include "programCache.hpp"
+#include "shaderCompiler.hpp"
+#include "shaderMinifier.hpp"
+#include "sourceMap.hpp"
 
 namespace {
-    // Get last time modified for file
-    time_t getMod(const std::string& path) {
-        struct stat sb;
-        if (stat(path.c_str(), &sb) == -1) {
-            ADD_LOG("[shader] stat failed for '%s'\n", path.c_str());
-            return (time_t) - 1;
-        }
-        return sb.st_mtime;
-    }
+    const float FREEZE_IDLE_SECONDS = 1.f;
 
     std::string toString(UniformType type) {
         switch (type) {
@@ -31,6 +30,69 @@ namespace {
             return "toString(type) unimplemented";
         }
     }
+
+    size_t uniformSize(UniformType type) {
+        switch (type) {
+        case UniformType::Float:
+            return sizeof(GLfloat);
+        case UniformType::Vec2:
+            return 2 * sizeof(GLfloat);
+        case UniformType::Vec3:
+            return 3 * sizeof(GLfloat);
+        default:
+            return 0;
+        }
+    }
+
+    bool sameValues(const std::unordered_map<std::string, Uniform>& a,
+                    const std::unordered_map<std::string, Uniform>& b) {
+        if (a.size() != b.size())
+            return false;
+        for (auto& u : a) {
+            auto other = b.find(u.first);
+            if (other == b.end() || other->second.type != u.second.type ||
+                memcmp(other->second.value, u.second.value, uniformSize(u.second.type)) != 0)
+                return false;
+        }
+        return true;
+    }
+
+    // Float literal that is never parsed as an int
+    std::string toLiteral(GLfloat value) {
+        char literal[32];
+        if (!std::isfinite(value)) {
+            // GLSL has no literals for these, the exact bits keep the sign and payload
+            uint32_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            snprintf(literal, sizeof(literal), "uintBitsToFloat(0x%08xu)", bits);
+            return literal;
+        }
+        snprintf(literal, sizeof(literal), "%.9g", value);
+        std::string str(literal);
+        if (str.find_first_of(".e") == std::string::npos)
+            str += ".0";
+        return str;
+    }
+
+    void uploadUniform(GLint location, const Uniform& uniform) {
+        switch (uniform.type) {
+        case UniformType::Float:
+            glUniform1f(location, *uniform.value);
+            break;
+        case UniformType::Vec2:
+            glUniform2fv(location, 1, uniform.value);
+            break;
+        case UniformType::Vec3:
+            glUniform3fv(location, 1, uniform.value);
+            break;
+        default:
+            ADD_LOG(
+                "[shader] Setting uniform of type '%s' is unimplemented\n",
+                toString(uniform.type).c_str()
+            );
+            break;
+        }
+    }
 }
 
 #ifdef ROCKET
@@ -38,56 +100,99 @@ Shader::Shader(const std::string& name, sync_device* rocket, const std::string&
                const std::string& fragPath, const std::string& geomPath) :
     _progID(0),
     _filePaths(3),
-    _fileMods(3),
     _name(name),
-    _rocket(rocket)
+    _rocket(rocket),
+    _freezing(false),
+    _pendingFrozen(false),
+    _frozenProgID(0)
 {
-    setVendor();
-    GLuint progID = loadProgram(vertPath, fragPath, geomPath);
-    if (progID != 0) _progID = progID;
+    startLoad(vertPath, fragPath, geomPath);
+    // The first program is needed right away
+    if (_pendingJob) {
+        ShaderCompiler::instance().wait(*_pendingJob);
+        finishLoad();
+    }
 }
 #else
 Shader::Shader(const std::string& vertPath, const std::string& fragPath,
                const std::string& geomPath) :
     _progID(0),
     _filePaths(3),
-    _fileMods(3)
+    _freezing(false),
+    _pendingFrozen(false),
+    _frozenProgID(0)
 {
-    setVendor();
-    GLuint progID = loadProgram(vertPath, fragPath, geomPath);
-    if (progID != 0) _progID = progID;
+    startLoad(vertPath, fragPath, geomPath);
+    // The first program is needed right away
+    if (_pendingJob) {
+        ShaderCompiler::instance().wait(*_pendingJob);
+        finishLoad();
+    }
 }
 #endif // ROCKET
 
 Shader::~Shader()
 {
-    glDeleteProgram(_progID);
+    if (_pendingJob)
+        ShaderCompiler::instance().cancel(_pendingJob);
+    for (auto& variant : _variants)
+        glDeleteProgram(variant.program);
+    glDeleteProgram(_frozenProgID);
 }
 
 #ifdef ROCKET
 Shader::Shader(Shader&& other) :
     _progID(other._progID),
-    _vendor(other._vendor),
-    _filePaths(other._filePaths),
-    _fileMods(other._fileMods),
-    _uniforms(other._uniforms),
-    _dynamicUniforms(other._dynamicUniforms),
-    _name(other._name),
+    _filePaths(std::move(other._filePaths)),
+    _uniforms(std::move(other._uniforms)),
+    _dynamicUniforms(std::move(other._dynamicUniforms)),
+    _uniformSlots(std::move(other._uniformSlots)),
+    _dynamicBindings(std::move(other._dynamicBindings)),
+    _name(std::move(other._name)),
     _rocket(other._rocket),
-    _rocketUniforms(other._rocketUniforms)
+    _rocketUniforms(std::move(other._rocketUniforms)),
+    _rocketBindings(std::move(other._rocketBindings)),
+    _paramBlock(std::move(other._paramBlock)),
+    _blocks(std::move(other._blocks)),
+    _pendingJob(std::move(other._pendingJob)),
+    _pendingKey(other._pendingKey),
+    _defines(std::move(other._defines)),
+    _pendingDefines(std::move(other._pendingDefines)),
+    _variants(std::move(other._variants)),
+    _freezing(other._freezing),
+    _pendingFrozen(other._pendingFrozen),
+    _frozenProgID(other._frozenProgID),
+    _freezeSnapshot(std::move(other._freezeSnapshot)),
+    _lastValues(std::move(other._lastValues)),
+    _idleTime(other._idleTime)
 {
     other._progID = 0;
+    other._frozenProgID = 0;
 }
 #else
 Shader::Shader(Shader&& other) :
     _progID(other._progID),
-    _vendor(other._vendor),
-    _filePaths(other._filePaths),
-    _fileMods(other._fileMods),
-    _uniforms(other._uniforms),
-    _dynamicUniforms(other._dynamicUniforms)
+    _filePaths(std::move(other._filePaths)),
+    _uniforms(std::move(other._uniforms)),
+    _dynamicUniforms(std::move(other._dynamicUniforms)),
+    _uniformSlots(std::move(other._uniformSlots)),
+    _dynamicBindings(std::move(other._dynamicBindings)),
+    _paramBlock(std::move(other._paramBlock)),
+    _blocks(std::move(other._blocks)),
+    _pendingJob(std::move(other._pendingJob)),
+    _pendingKey(other._pendingKey),
+    _defines(std::move(other._defines)),
+    _pendingDefines(std::move(other._pendingDefines)),
+    _variants(std::move(other._variants)),
+    _freezing(other._freezing),
+    _pendingFrozen(other._pendingFrozen),
+    _frozenProgID(other._frozenProgID),
+    _freezeSnapshot(std::move(other._freezeSnapshot)),
+    _lastValues(std::move(other._lastValues)),
+    _idleTime(other._idleTime)
 {
     other._progID = 0;
+    other._frozenProgID = 0;
 }
 #endif // ROCKET
 
@@ -97,34 +202,125 @@ void Shader::bind(double syncRow)
     glUseProgram(_progID);
     setDynamicUniforms();
     setRocketUniforms(syncRow);
+    if (_paramBlock)
+        _paramBlock->upload();
 }
 #else
 void Shader::bind()
 {
     glUseProgram(_progID);
     setDynamicUniforms();
+    if (_paramBlock)
+        _paramBlock->upload();
 }
 #endif // ROCKET
 
-bool Shader::reload()
-{
-    // Reload shaders if some was modified
-    for (auto j = 0u; j < 3; ++j) {
-        for (auto i = 0u; i < _filePaths[j].size(); ++i) {
-            if (_fileMods[j][i] != getMod(_filePaths[j][i])) {
-                GLuint progID = loadProgram(_filePaths[1].size() > 0 ? _filePaths[1][0] : "",
-                                            _filePaths[0].size() > 0 ? _filePaths[0][0] : "",
-                                            _filePaths[2].size() > 0 ? _filePaths[2][0] : "");
-                if (progID != 0) {
-                    glDeleteProgram(_progID);
-                    _progID = progID;
-                    return false;
-                }
-                return true;
-            }
+void Shader::reload()
+{
+    dropFrozen();
+    // Other variants are deleted, the bound one is replaced once the new one is ready
+    // and has to be recompiled if switched back to before that
+    for (auto variant = _variants.begin(); variant != _variants.end();) {
+        if (variant->program != _progID) {
+            glDeleteProgram(variant->program);
+            variant = _variants.erase(variant);
+        } else {
+            variant->stale = true;
+            ++variant;
         }
     }
-    return false;
+
+    restartLoad();
+}
+
+void Shader::update()
+{
+    // Swap in the new program once it's ready, the old one stays bound until then
+    if (_pendingJob && ShaderCompiler::instance().isDone(*_pendingJob))
+        finishLoad();
+    updateFreeze();
+}
+
+void Shader::setDefines(const Defines& defines)
+{
+    if (defines == _defines)
+        return;
+    _defines = defines;
+    dropFrozen();
+
+    auto variant = std::find_if(_variants.begin(), _variants.end(),
+                                [&](const Variant& v){ return v.defines == defines; });
+    if (variant == _variants.end() || variant->stale) {
+        restartLoad();
+        return;
+    }
+
+    // Compile for some other variant isn't needed anymore
+    if (_pendingJob) {
+        ShaderCompiler::instance().cancel(_pendingJob);
+        _pendingJob.reset();
+    }
+    _variants.splice(_variants.begin(), _variants, variant);
+    setProgram(variant->program, variant->reflection.get());
+}
+
+const Shader::Defines& Shader::defines() const
+{
+    return _defines;
+}
+
+void Shader::setFreezing(bool freezing)
+{
+    _freezing = freezing;
+}
+
+bool Shader::frozen() const
+{
+    return _progID != 0 && _progID == _frozenProgID;
+}
+
+bool Shader::hasVariant(const Defines& defines) const
+{
+    return std::any_of(_variants.begin(), _variants.end(),
+                       [&](const Variant& v){ return v.defines == defines && !v.stale; });
+}
+
+bool Shader::pending() const
+{
+    return _pendingJob != nullptr;
+}
+
+bool Shader::linked() const
+{
+    return _progID != 0;
+}
+
+std::vector<std::string> Shader::sourcePaths() const
+{
+    std::vector<std::string> paths;
+    for (auto& stagePaths : _filePaths)
+        paths.insert(paths.end(), stagePaths.begin(), stagePaths.end());
+    return paths;
+}
+
+void Shader::attachBlock(UniformBuffer& buffer)
+{
+    _blocks.push_back(&buffer);
+    if (_progID == 0)
+        return;
+
+    bool spirv = std::any_of(_variants.begin(), _variants.end(),
+                             [](const Variant& v){ return v.reflection != nullptr; });
+    if (!spirv) {
+        buffer.reflect(_progID);
+        return;
+    }
+    // SPIR-V programs have their block bindings baked in, the rebuild is from cached modules
+    reload();
+    if (_pendingJob) {
+        ShaderCompiler::instance().wait(*_pendingJob);
+        finishLoad();
+    }
 }
 
 std::unordered_map<std::string, Uniform>& Shader::dynamicUniforms()
@@ -142,105 +338,209 @@ void Shader::setVec2(const std::string& name, GLfloat x, GLfloat y)
     setUniform(name, {UniformType::Vec2, {x, y, 0.f}});
 }
 
-void Shader::setVendor()
+void Shader::restartLoad(bool frozen)
 {
-    const char* vendor = (const char*) glGetString(GL_VENDOR);
-    if (strcmp(vendor, "NVIDIA Corporation") == 0)
-        _vendor = Vendor::Nvidia;
-    else if (strcmp(vendor, "Intel Inc.") == 0)
-        _vendor = Vendor::Intel;
-    else {
-        ADD_LOG("[shader] Include aware error parsing not supported for '%s'\n", vendor);
-        _vendor = Vendor::NotSupported;
-    }
+    // Copy since loading resets the paths
+    std::string vertPath = _filePaths[1].size() > 0 ? _filePaths[1][0] : "";
+    std::string fragPath = _filePaths[0].size() > 0 ? _filePaths[0][0] : "";
+    std::string geomPath = _filePaths[2].size() > 0 ? _filePaths[2][0] : "";
+    startLoad(vertPath, fragPath, geomPath, frozen);
 }
 
-GLuint Shader::loadProgram(const std::string& vertPath, const std::string& fragPath,
-                           const std::string& geomPath)
+void Shader::startLoad(const std::string& vertPath, const std::string& fragPath,
+                       const std::string& geomPath, bool frozen)
 {
     // Clear vectors
     for (auto& v : _filePaths) v.clear();
-    for (auto& v : _fileMods) v.clear();
-
-    // Get a program id
-    GLuint progID = glCreateProgram();
-
-    //Load and attacth shaders
-    GLuint vertexShader = loadShader(vertPath, GL_VERTEX_SHADER);
-    if (vertexShader == 0) {
-        glDeleteProgram(progID);
-        progID = 0;
-        return 0;
-    }
-    glAttachShader(progID, vertexShader);
-
-    GLuint geometryShader = 0;
-    if (!geomPath.empty()) {
-        geometryShader = loadShader(geomPath, GL_GEOMETRY_SHADER);
-        if (geometryShader == 0) {
-            glDeleteShader(vertexShader);
-            glDeleteProgram(progID);
-            progID = 0;
-            return 0;
+
+    // Preprocess all stages first so the program can be looked up from cache
+    ShaderSource vertSource;
+    if (!parseFromFile(vertPath, GL_VERTEX_SHADER, vertSource))
+        return;
+
+    ShaderSource geomSource;
+    if (!geomPath.empty() && !parseFromFile(geomPath, GL_GEOMETRY_SHADER, geomSource))
+        return;
+
+    ShaderSource fragSource;
+    if (!parseFromFile(fragPath, GL_FRAGMENT_SHADER, fragSource))
+        return;
+    IncludeCache::instance().report();
+
+    if (!_defines.empty()) {
+        std::string defines;
+        for (auto& d : _defines)
+            defines += "#define " + d.first + ' ' + d.second + '\n';
+        for (ShaderSource* source : {&vertSource, &geomSource, &fragSource}) {
+            if (!source->empty())
+                source->insertAfterVersion(std::string(defines),
+                                           {source->pathIndex("<defines>"), 0});
         }
-        glAttachShader(progID, geometryShader);
+    }
+    if (_defines.count(Heatmap::DEFINE) != 0)
+        ADD_LOG("[heatmap] Counting steps of %zu loops\n", Heatmap::instrument(fragSource));
+
+    if (frozen) {
+        size_t count = freezeUniforms(vertSource) + freezeUniforms(geomSource) +
+                       freezeUniforms(fragSource);
+        // Uniforms inside blocks can't be turned into constants
+        if (count == 0)
+            return;
+    }
+    ShaderMinifier& minifier = ShaderMinifier::instance();
+    if (minifier.enabled()) {
+        auto report = [&](const char* stage, ShaderSource& source) {
+            if (source.empty())
+                return;
+            auto stats = minifier.process(source);
+            ADD_LOG("[minify] %s %zu -> %zu bytes, stripped %zu/%zu functions, %zu/%zu constants\n",
+                    stage, stats.bytesBefore, stats.bytesAfter, stats.strippedFunctions,
+                    stats.functions, stats.strippedConstants, stats.constants);
+        };
+        report("vert", vertSource);
+        report("geom", geomSource);
+        report("frag", fragSource);
+    }
+    // Driver compile time scales with these
+    if (geomPath.empty())
+        ADD_LOG("[shader] Preprocessed lines: vert %zu, frag %zu\n", vertSource.lineCount(),
+                fragSource.lineCount());
+    else
+        ADD_LOG("[shader] Preprocessed lines: vert %zu, geom %zu, frag %zu\n",
+                vertSource.lineCount(), geomSource.lineCount(), fragSource.lineCount());
+
+    // A compile that's still running is for outdated sources
+    if (_pendingJob) {
+        ShaderCompiler::instance().cancel(_pendingJob);
+        _pendingJob.reset();
     }
 
-    GLuint fragmentShader = loadShader(fragPath, GL_FRAGMENT_SHADER);
-    if (fragmentShader == 0) {
-        glDeleteShader(vertexShader);
-        glDeleteShader(geometryShader);
-        glDeleteProgram(progID);
-        progID = 0;
-        return 0;
+    _pendingDefines = _defines;
+    _pendingFrozen = frozen;
+    // Specialized programs change with every edit so they would only fill the cache
+    ProgramCache& cache = ProgramCache::instance();
+    _pendingKey = cache.key({&vertSource, &geomSource, &fragSource});
+    // SPIR-V programs are reflected from their modules so they have a cache of their own
+    bool spirv = !frozen && SpirvCompiler::instance().supported();
+    GLuint progID = frozen || spirv ? 0 : cache.load(_pendingKey);
+    if (progID != 0) {
+        addVariant(_pendingDefines, progID, nullptr);
+        setProgram(progID);
+        return;
     }
-    glAttachShader(progID, fragmentShader);
 
-    //Link program
-    glLinkProgram(progID);
+    auto job = std::make_shared<ShaderCompiler::Job>();
+    job->stages.emplace_back(GL_VERTEX_SHADER, std::move(vertSource));
+    if (!geomSource.empty())
+        job->stages.emplace_back(GL_GEOMETRY_SHADER, std::move(geomSource));
+    job->stages.emplace_back(GL_FRAGMENT_SHADER, std::move(fragSource));
+    job->spirv = spirv;
+    job->key = _pendingKey;
+    job->blockBindings = blockBindings();
+    _pendingJob = ShaderCompiler::instance().submit(job);
+    _compileTime.reset();
+}
+
+void Shader::finishLoad()
+{
+    auto job = std::move(_pendingJob);
+    GLuint progID = job->program;
+    if (!job->log.empty())
+        ADD_LOG("[spirv] %s", job->log.c_str());
+
     GLint programSuccess = GL_FALSE;
     glGetProgramiv(progID, GL_LINK_STATUS, &programSuccess);
     if (programSuccess == GL_FALSE) {
-        ADD_LOG("[shader] Error linking program %u\n", progID);
-        ADD_LOG("[shader] Error code: %d", programSuccess);
-        printProgramLog(progID);
-        glDeleteShader(vertexShader);
-        glDeleteShader(geometryShader);
-        glDeleteShader(fragmentShader);
-        glDeleteProgram(progID);
-        progID = 0;
-        return 0;
+        // Failed stages also fail the link so report them first
+        bool compileFailed = false;
+        // Shaders are created in stage order
+        for (size_t i = 0; i < job->shaders.size(); ++i) {
+            GLuint shaderID = job->shaders[i];
+            GLint shaderCompiled = GL_FALSE;
+            glGetShaderiv(shaderID, GL_COMPILE_STATUS, &shaderCompiled);
+            if (shaderCompiled == GL_FALSE) {
+                ADD_LOG("[shader] Unable to compile shader %u\n", shaderID);
+                printShaderLog(shaderID, job->stages[i].second);
+                compileFailed = true;
+            }
+        }
+        if (!compileFailed) {
+            ADD_LOG("[shader] Error linking program %u\n", progID);
+            ADD_LOG("[shader] Error code: %d", programSuccess);
+            printProgramLog(progID);
+        }
+        ShaderCompiler::instance().cancel(job);
+        return;
     }
 
-    glDeleteShader(vertexShader);
-    glDeleteShader(geometryShader);
-    glDeleteShader(fragmentShader);
+    for (GLuint shaderID : job->shaders)
+        glDeleteShader(shaderID);
+    job->shaders.clear();
+
+    ADD_LOG("[shader] Program %u compiled in %.1fms\n", progID, _compileTime.getSeconds() * 1000.f);
+    if (_pendingFrozen) {
+        // Bound by updateFreeze() if the values weren't touched during the compile
+        glDeleteProgram(_frozenProgID);
+        _frozenProgID = progID;
+        return;
+    }
+    // Binaries of SPIR-V programs would need the reflection stored with them
+    if (!job->reflection)
+        ProgramCache::instance().store(_pendingKey, progID);
+    addVariant(_pendingDefines, progID, job->reflection);
+    setProgram(progID, job->reflection.get());
+}
 
+void Shader::setProgram(GLuint progID, const SpirvReflection* reflection)
+{
     // Query uniforms
-    GLint uCount;
-    glGetProgramiv(progID, GL_ACTIVE_UNIFORMS, &uCount);
     _uniforms.clear();
-    for (GLuint i = 0; i < uCount; ++i) {
-        char name[64];
-        GLenum glType;
-        GLint size;
-        glGetActiveUniform(progID, i, sizeof(name), NULL, &size, &glType, name);
-        UniformType type;
-        switch (glType) {
-        case GL_FLOAT:
-            type = UniformType::Float;
-            break;
-        case GL_FLOAT_VEC2:
-            type = UniformType::Vec2;
-            break;
-        case GL_FLOAT_VEC3:
-            type = UniformType::Vec3;
-            break;
-        default:
-            ADD_LOG("[shader] Unknown uniform type %u\n", glType);
-            break;
+    if (reflection != nullptr) {
+        for (auto& u : reflection->uniforms)
+            addUniform(u.name, u.type, u.location);
+        // Block members don't have locations
+        for (auto& b : reflection->blocks) {
+            for (auto& m : b.members)
+                addUniform(m.name, m.type, -1);
         }
-        _uniforms.insert({name, std::make_pair(type, glGetUniformLocation(progID, name))});
+    } else {
+        GLint uCount;
+        glGetProgramiv(progID, GL_ACTIVE_UNIFORMS, &uCount);
+        for (GLint i = 0; i < uCount; ++i) {
+            char name[64];
+            GLenum glType;
+            GLint size;
+            glGetActiveUniform(progID, i, sizeof(name), NULL, &size, &glType, name);
+            // Block members don't have locations
+            addUniform(name, glType, glGetUniformLocation(progID, name));
+        }
+    }
+
+    // Shared blocks keep their buffers, Params gets its own
+    auto findBlock = [&](const std::string& name) -> const SpirvReflection::Block* {
+        for (auto& b : reflection->blocks) {
+            if (b.name == name)
+                return &b;
+        }
+        return nullptr;
+    };
+    for (auto* block : _blocks) {
+        if (reflection == nullptr)
+            block->reflect(progID);
+        else if (auto* b = findBlock(block->blockName()))
+            block->reflect(*b);
+    }
+    const SpirvReflection::Block* params = reflection != nullptr ? findBlock("Params") : nullptr;
+    if (params != nullptr ||
+        (reflection == nullptr && glGetUniformBlockIndex(progID, "Params") != GL_INVALID_INDEX)) {
+        if (!_paramBlock)
+            _paramBlock = std::make_unique<UniformBuffer>("Params", PARAMS_BINDING);
+        if (params != nullptr)
+            _paramBlock->reflect(*params);
+        else
+            _paramBlock->reflect(progID);
+    } else {
+        _paramBlock.reset();
     }
 
     // Rebuild uniforms
@@ -293,78 +593,218 @@ GLuint Shader::loadProgram(const std::string& vertPath, const std::string& fragP
             break;
         }
     }
-    _dynamicUniforms = newDynamics;
+    // Frozen uniforms are gone from the specialized program but stay editable
+    if (progID == _frozenProgID) {
+        for (auto& u : _freezeSnapshot) {
+            if (auto existing = _dynamicUniforms.find(u.first); existing != _dynamicUniforms.end())
+                newDynamics.insert(*existing);
+        }
+    }
+    _dynamicUniforms = std::move(newDynamics);
+#ifdef ROCKET
+    _rocketUniforms = std::move(newRockets);
+#endif // ROCKET
+
+    // Flatten bindings so binding the shader doesn't need lookups
+    _dynamicBindings.clear();
+    for (auto& u : _dynamicUniforms) {
+        auto uniform = _uniforms.find(u.first);
+        GLint location = uniform != _uniforms.end() ? uniform->second.second : -1;
+        GLint offset = _paramBlock ? _paramBlock->offset(u.first, u.second.type) : -1;
+        // Frozen uniforms are constants in the program
+        if (location == -1 && offset == -1)
+            continue;
+        _dynamicBindings.push_back({location, offset, &u.second, false, {}});
+    }
 #ifdef ROCKET
-    _rocketUniforms = newRockets;
+    _rocketBindings.clear();
+    for (auto& u : _rocketUniforms) {
+        GLint offset = _paramBlock ? _paramBlock->offset(u.first, UniformType::Float) : -1;
+        _rocketBindings.push_back({_uniforms.at(u.first).second, offset, u.second, false, 0.f});
+    }
 #endif // ROCKET
 
+    // Re-resolve handles against the new program
+    for (auto& slot : _uniformSlots)
+        resolveSlot(slot);
+
+    // Variants own the programs
+    _progID = progID;
+
     ADD_LOG("[shader] Shader %u loaded\n", progID);
+}
+
+void Shader::addVariant(const Defines& defines, GLuint progID,
+                        const std::shared_ptr<const SpirvReflection>& reflection)
+{
+    // Reloaded variants replace the old program
+    auto old = std::find_if(_variants.begin(), _variants.end(),
+                            [&](const Variant& v){ return v.defines == defines; });
+    if (old != _variants.end()) {
+        glDeleteProgram(old->program);
+        _variants.erase(old);
+    }
+    _variants.push_front({defines, progID, reflection, false});
 
-    return progID;
+    if (_variants.size() > MAX_VARIANTS) {
+        glDeleteProgram(_variants.back().program);
+        _variants.pop_back();
+    }
 }
 
-GLuint Shader::loadShader(const std::string& mainPath, GLenum shaderType)
+void Shader::addUniform(const std::string& name, GLenum glType, GLint location)
 {
-    GLuint shaderID = 0;
-    std::string shaderStr = parseFromFile(mainPath, shaderType);
-    if (!shaderStr.empty()){
-        shaderID = glCreateShader(shaderType);
-        const GLchar* shaderSource = shaderStr.c_str();
-        glShaderSource(shaderID, 1, &shaderSource, NULL);
-        glCompileShader(shaderID);
-        GLint shaderCompiled = GL_FALSE;
-        glGetShaderiv(shaderID, GL_COMPILE_STATUS, &shaderCompiled);
-        if (shaderCompiled == GL_FALSE) {
-            ADD_LOG("[shader] Unable to compile shader %u\n", shaderID);
-            printShaderLog(shaderID);
-            shaderID = 0;
-        }
+    UniformType type;
+    switch (glType) {
+    case GL_FLOAT:
+        type = UniformType::Float;
+        break;
+    case GL_FLOAT_VEC2:
+        type = UniformType::Vec2;
+        break;
+    case GL_FLOAT_VEC3:
+        type = UniformType::Vec3;
+        break;
+    default:
+        ADD_LOG("[shader] Unknown uniform type %u\n", glType);
+        return;
     }
-    return shaderID;
+    _uniforms.insert({name, std::make_pair(type, location)});
 }
 
-std::string Shader::parseFromFile(const std::string& filePath, GLenum shaderType)
+void Shader::updateFreeze()
 {
-    std::ifstream sourceFile(filePath.c_str());
-    std::string shaderStr;
-    if (sourceFile) {
-        // Push filepath and timestamp to vectors
-        if (shaderType == GL_FRAGMENT_SHADER) {
-            _filePaths[0].emplace_back(filePath);
-            _fileMods[0].emplace_back(getMod(filePath));
-        } else if (shaderType == GL_VERTEX_SHADER) {
-            _filePaths[1].emplace_back(filePath);
-            _fileMods[1].emplace_back(getMod(filePath));
-        } else {
-            _filePaths[2].emplace_back(filePath);
-            _fileMods[2].emplace_back(getMod(filePath));
+    // Any edit restarts the wait
+    if (!sameValues(_dynamicUniforms, _lastValues)) {
+        _lastValues = _dynamicUniforms;
+        _idleTime.reset();
+    }
+
+    bool snapshotValid = sameValues(_dynamicUniforms, _freezeSnapshot);
+    if (frozen()) {
+        // Edits are only visible through the generic program
+        if ((!_freezing || !snapshotValid) && !_variants.empty()) {
+            setProgram(_variants.front().program, _variants.front().reflection.get());
+            ADD_LOG("[shader] Unfroze program %u\n", _frozenProgID);
         }
+        return;
+    }
+    if (!_freezing || _pendingJob || _variants.empty() ||
+        _idleTime.getSeconds() < FREEZE_IDLE_SECONDS)
+        return;
+
+    if (!snapshotValid) {
+        // Snapshot is kept even if nothing was frozen so a failed attempt isn't retried
+        glDeleteProgram(_frozenProgID);
+        _frozenProgID = 0;
+        _freezeSnapshot = _dynamicUniforms;
+        restartLoad(true);
+    } else if (_frozenProgID != 0) {
+        setProgram(_frozenProgID);
+        ADD_LOG("[shader] Froze %zu uniforms into program %u\n", _freezeSnapshot.size(),
+                _frozenProgID);
+    }
+}
 
-        // Get directory path for the file for possible includes
-        std::string dirPath(filePath);
-        dirPath.erase(dirPath.find_last_of('/') + 1);
-
-        // Mark file start for error parsing
-        shaderStr += "// File: " + filePath + '\n';
-
-        // Parse lines
-        for (std::string line; std::getline(sourceFile, line);) {
-            // Handle recursive includes, expect correct syntax
-            if (line.compare(0, 9, "#include ") == 0) {
-                line.erase(0, 10);
-                line.pop_back();
-                line = parseFromFile(dirPath + line, shaderType);
-                if (line.empty()) return "";
-            }
-            shaderStr += line + '\n';
+void Shader::dropFrozen()
+{
+    if (frozen() && !_variants.empty())
+        setProgram(_variants.front().program, _variants.front().reflection.get());
+    glDeleteProgram(_frozenProgID);
+    _frozenProgID = 0;
+    _freezeSnapshot.clear();
+}
+
+size_t Shader::freezeUniforms(ShaderSource& source) const
+{
+    return source.replaceLines([&](std::string_view line, std::string& replacement) {
+        // Expect "uniform <type> <name>;" on its own line
+        std::istringstream tokens{std::string(line)};
+        std::string qualifier, type, name;
+        if (!(tokens >> qualifier >> type >> name) || qualifier != "uniform" ||
+            name.back() != ';')
+            return false;
+        name.pop_back();
+
+        auto value = _freezeSnapshot.find(name);
+        if (value == _freezeSnapshot.end() || toString(value->second.type) != type)
+            return false;
+
+        const GLfloat* v = value->second.value;
+        switch (value->second.type) {
+        case UniformType::Float:
+            replacement = "const float " + name + " = " + toLiteral(v[0]) + ";";
+            break;
+        case UniformType::Vec2:
+            replacement = "const vec2 " + name + " = vec2(" + toLiteral(v[0]) + ", " +
+                          toLiteral(v[1]) + ");";
+            break;
+        case UniformType::Vec3:
+            replacement = "const vec3 " + name + " = vec3(" + toLiteral(v[0]) + ", " +
+                          toLiteral(v[1]) + ", " + toLiteral(v[2]) + ");";
+            break;
+        default:
+            return false;
         }
+        return true;
+    });
+}
 
-        // Mark file end for error parsing
-        shaderStr += "// File: " + filePath + '\n';
-    } else {
+std::map<std::string, GLuint> Shader::blockBindings() const
+{
+    std::map<std::string, GLuint> bindings{{"Params", PARAMS_BINDING}};
+    for (auto* block : _blocks)
+        bindings[block->blockName()] = block->binding();
+    return bindings;
+}
+
+bool Shader::parseFromFile(const std::string& filePath, GLenum shaderType,
+                           ShaderSource& source)
+{
+    auto file = IncludeCache::instance().get(filePath);
+    if (!file) {
         ADD_LOG("[shader] Unable to open file '%s'\n", filePath.c_str());
+        return false;
     }
-    return shaderStr;
+
+    // Files can only be in the source once if they are guarded
+    bool included = std::find(source.files.begin(), source.files.end(), file) !=
+                    source.files.end();
+    if (included && file->once)
+        return true;
+    // Added before includes to also stop guarded files including themselves
+    source.files.push_back(file);
+
+    // Push filepath to vectors and make sure it's watched for changes
+    if (shaderType == GL_FRAGMENT_SHADER)
+        _filePaths[0].emplace_back(filePath);
+    else if (shaderType == GL_VERTEX_SHADER)
+        _filePaths[1].emplace_back(filePath);
+    else
+        _filePaths[2].emplace_back(filePath);
+    FileWatcher::instance().watch(filePath);
+
+    // Get directory path for the file for possible includes
+    std::string dirPath(filePath);
+    dirPath.erase(dirPath.find_last_of('/') + 1);
+
+    // Origins map error lines back to the file
+    ShaderSource::Origin origin{source.pathIndex(filePath), 0};
+    for (auto& piece : file->pieces) {
+        if (!piece.text.empty()) {
+            source.push(piece.text, origin);
+            origin.line += (uint32_t)std::count(piece.text.begin(), piece.text.end(), '\n');
+        }
+        if (piece.include.empty())
+            continue;
+        // Handle recursive includes
+        if (!parseFromFile(dirPath + piece.include, shaderType, source))
+            return false;
+        // Include line is replaced by an empty one
+        source.push("\n", origin);
+        ++origin.line;
+    }
+    return true;
 }
 
 void Shader::printProgramLog(GLuint program) const
@@ -381,94 +821,16 @@ void Shader::printProgramLog(GLuint program) const
     }
 }
 
-void Shader::printShaderLog(GLuint shader) const
+void Shader::printShaderLog(GLuint shader, const ShaderSource& source) const
 {
     if (glIsShader(shader) == GL_TRUE) {
-        // Get errors
         GLint maxLength = 0;
         glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &maxLength);
-        char* errorLog = new char[maxLength];
-        glGetShaderInfoLog(shader, maxLength, &maxLength, errorLog);
+        std::string errorLog(maxLength, '\0');
+        glGetShaderInfoLog(shader, maxLength, &maxLength, &errorLog[0]);
+        errorLog.resize(maxLength);
 
-        if (_vendor == Vendor::NotSupported) {
-            ADD_LOG("%s\n", errorLog);
-            delete[] errorLog;
-            return;
-        }
-
-        // Convert error string to a stream for easy line access
-        std::istringstream errorStream(errorLog);
-
-        // Get source string
-        glGetShaderiv(shader, GL_SHADER_SOURCE_LENGTH, &maxLength);
-        char* shaderStr = new char[maxLength];
-        glGetShaderSource(shader, maxLength, &maxLength, shaderStr);
-
-        // Set up vendor specific parsing
-        std::string linePrefix;
-        char lineNumCutoff;
-        if (_vendor == Vendor::Nvidia) {
-            linePrefix = "0(";
-            lineNumCutoff = ')';
-        } else if (_vendor == Vendor::Intel) {
-            linePrefix = "ERROR: 0:";
-            lineNumCutoff = ':';
-        } else {
-            ADD_LOG("[shader] Unimplemented vendor parsing\n");
-            ADD_LOG("%s\n", errorLog);
-            delete[] errorLog;
-            delete[] shaderStr;
-            return;
-        }
-
-        std::string lastFile;
-        // Parse correct file and line numbers to errors
-        for (std::string errLine; std::getline(errorStream, errLine);) {
-
-            // Only parse if error points to a line
-            if (errLine.compare(0, linePrefix.length(), linePrefix) == 0) {
-                // Extract error line in parsed source
-                auto lineNumEnd = errLine.find(lineNumCutoff, linePrefix.length() + 1);
-                uint32_t lineNum = std::stoi(errLine.substr(linePrefix.length(), lineNumEnd - 1));
-
-                std::stack<std::string> files;
-                std::stack<uint32_t> lines;
-                // Parse the source to error, track file and line in file
-                std::istringstream sourceStream(shaderStr);
-                for (auto i = 0u; i < lineNum; ++i) {
-                    std::string srcLine;
-                    std::getline(sourceStream, srcLine);
-                    if (srcLine.compare(0, 9, "// File: ") == 0) {
-                        srcLine.erase(0, 9);
-                        // If include-block ends, pop file and it's lines from stacks
-                        if (!files.empty() && srcLine.compare(files.top()) == 0) {
-                            files.pop();
-                            lines.pop();
-                        } else {// Push new file block to stacks
-                            files.push(srcLine);
-                            lines.push(0);
-                        }
-                    } else {
-                        ++lines.top();
-                    }
-                }
-
-                // Print the file if it changed from last error
-                if (lastFile.empty() || lastFile.compare(files.top()) != 0) {
-                    ADD_LOG("In file '%s'\n", files.top().c_str());
-                    lastFile = files.top();
-                }
-
-                // Insert the correct line number to error and print
-                errLine.erase(linePrefix.length(), lineNumEnd - linePrefix.length());
-                errLine.insert(linePrefix.length(), std::to_string(lines.top()));
-            }
-            ADD_LOG("%s\n", errLine.c_str());
-        }
-        ADD_LOG("\n");
-
-        delete[] errorLog;
-        delete[] shaderStr;
+        ADD_LOG("%s\n", SourceMap(source).remap(errorLog).c_str());
     } else {
         ADD_LOG("[shader] ID %u is not a shader\n", shader);
     }
@@ -493,40 +855,82 @@ GLint Shader::getUniform(const std::string& name, UniformType type) const
     return location;
 }
 
-void Shader::setUniform(const std::string& name, const Uniform& uniform)
+const GLint* Shader::uniformSlot(const std::string& name, UniformType type)
 {
-    GLint location = getUniform(name, uniform.type);
-    switch (uniform.type) {
-    case UniformType::Float:
-        glUniform1f(location, *uniform.value);
-        break;
-    case UniformType::Vec2:
-        glUniform2fv(location, 1, uniform.value);
-        break;
-    case UniformType::Vec3:
-        glUniform3fv(location, 1, uniform.value);
-        break;
-    default:
-        ADD_LOG(
-            "[shader] Setting uniform of type '%s' is unimplemented\n",
-            toString(uniform.type).c_str()
-        );
-        break;
+    auto slot = std::find_if(_uniformSlots.begin(), _uniformSlots.end(),
+                             [&](const UniformSlot& s){ return s.name == name; });
+    if (slot != _uniformSlots.end()) {
+        if (slot->type != type) {
+            ADD_LOG("[shader] Uniform '%s' is not of type '%s'\n", name.c_str(), toString(type).c_str());
+            return nullptr;
+        }
+        return &slot->location;
     }
+
+    _uniformSlots.push_back({name, type, -1});
+    resolveSlot(_uniformSlots.back());
+    return &_uniformSlots.back().location;
+}
+
+void Shader::resolveSlot(UniformSlot& slot) const
+{
+    // Uniforms get optimized out all the time so missing ones are fine
+    slot.location = -1;
+    auto uniform = _uniforms.find(slot.name);
+    if (uniform == _uniforms.end())
+        return;
+
+    auto [actualType, location] = uniform->second;
+    if (slot.type != actualType) {
+        ADD_LOG("[shader] Uniform '%s' is not of type '%s'\n", slot.name.c_str(), toString(slot.type).c_str());
+        return;
+    }
+    slot.location = location;
+}
+
+void Shader::setUniform(const std::string& name, const Uniform& uniform)
+{
+    uploadUniform(getUniform(name, uniform.type), uniform);
 }
 
 void Shader::setDynamicUniforms()
 {
-    for (auto& u : _dynamicUniforms) {
-        setUniform(u.first, u.second);
+    // Programs keep their uniform values so only changes need to be sent
+    for (auto& b : _dynamicBindings) {
+        size_t size = uniformSize(b.uniform->type);
+        bool changed = !b.valid || memcmp(b.shadow, b.uniform->value, size) != 0;
+        if (b.offset >= 0) {
+            // Buffer uploads are tracked by the buffer itself
+            if (changed)
+                _paramBlock->write(b.offset, b.uniform->value, size);
+        } else if (changed) {
+            uploadUniform(b.location, *b.uniform);
+            UniformStats::addUploaded();
+        } else {
+            UniformStats::addSkipped();
+        }
+        memcpy(b.shadow, b.uniform->value, size);
+        b.valid = true;
     }
 }
 
 #ifdef ROCKET
 void Shader::setRocketUniforms(double syncRow)
 {
-    for (auto& u : _rocketUniforms) {
-        setUniform(u.first, {UniformType::Float, {(GLfloat)sync_get_val(u.second, syncRow), 0.f, 0.f}});
+    for (auto& b : _rocketBindings) {
+        GLfloat value = (GLfloat)sync_get_val(b.track, syncRow);
+        bool changed = !b.valid || b.shadow != value;
+        if (b.offset >= 0) {
+            if (changed)
+                _paramBlock->write(b.offset, &value, sizeof(value));
+        } else if (changed) {
+            glUniform1f(b.location, value);
+            UniformStats::addUploaded();
+        } else {
+            UniformStats::addSkipped();
+        }
+        b.shadow = value;
+        b.valid = true;
     }
 }
 #endif // ROCKET
@@ -0,0 +1,237 @@
+#include "shaderCompiler.hpp"
+
+#include <algorithm>
+
+#include "cpuProfiler.hpp"
+#include "glExtensions.hpp"
+#include "log.hpp"
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif // GL_COMPLETION_STATUS_KHR
+
+namespace {
+    typedef void (*PFNMAXSHADERCOMPILERTHREADS)(GLuint count);
+
+    // Drivers tend to serialize some of the work between contexts anyway
+    const unsigned MAX_WORKERS = 4;
+}
+
+ShaderCompiler& ShaderCompiler::instance()
+{
+    static ShaderCompiler compiler;
+    return compiler;
+}
+
+ShaderCompiler::ShaderCompiler() :
+    _mode(Mode::Sync),
+    _window(nullptr),
+    _running(false)
+{ }
+
+void ShaderCompiler::init(const Window& window)
+{
+    SpirvCompiler::instance().init();
+
+    const char* ext = nullptr;
+    const char* threadsFunc = nullptr;
+    if (hasGLExtension("GL_KHR_parallel_shader_compile")) {
+        ext = "GL_KHR_parallel_shader_compile";
+        threadsFunc = "glMaxShaderCompilerThreadsKHR";
+    } else if (hasGLExtension("GL_ARB_parallel_shader_compile")) {
+        ext = "GL_ARB_parallel_shader_compile";
+        threadsFunc = "glMaxShaderCompilerThreadsARB";
+    }
+
+    if (ext != nullptr) {
+        // Let the driver pick the number of threads
+        auto maxThreads = (PFNMAXSHADERCOMPILERTHREADS)gl3wGetProcAddress(threadsFunc);
+        if (maxThreads != nullptr)
+            maxThreads(0xFFFFFFFF);
+        _mode = Mode::Parallel;
+        ADD_LOG("[compiler] Using %s\n", ext);
+        return;
+    }
+
+    // Leave cores for the render thread and the driver
+    unsigned workerCount = std::thread::hardware_concurrency() / 2;
+    workerCount = std::max(1u, std::min(MAX_WORKERS, workerCount));
+    for (unsigned i = 0; i < workerCount; ++i) {
+        Window::SharedContext context = window.createSharedContext();
+        if (!context.valid())
+            break;
+        _contexts.push_back(context);
+    }
+    if (_contexts.empty()) {
+        ADD_LOG("[compiler] Shared context creation failed, compiling synchronously\n");
+        return;
+    }
+    _mode = Mode::Worker;
+    _window = &window;
+    _running = true;
+    for (const Window::SharedContext& context : _contexts)
+        _workers.emplace_back(&ShaderCompiler::run, this, context);
+    ADD_LOG("[compiler] Using %zu worker threads\n", _workers.size());
+}
+
+void ShaderCompiler::destroy()
+{
+    if (_mode == Mode::Worker) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _running = false;
+        }
+        _cond.notify_all();
+        for (auto& worker : _workers)
+            worker.join();
+        _workers.clear();
+        for (Window::SharedContext& context : _contexts)
+            _window->destroySharedContext(context);
+        _contexts.clear();
+        _window = nullptr;
+    }
+    SpirvCompiler::instance().destroy();
+    _mode = Mode::Sync;
+}
+
+std::shared_ptr<ShaderCompiler::Job> ShaderCompiler::submit(const std::shared_ptr<Job>& job)
+{
+    if (_mode == Mode::Worker) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _queue.emplace_back(job);
+        }
+        _cond.notify_one();
+    } else {
+        // The driver only blocks on status queries with parallel compile
+        compile(*job);
+        job->done = _mode == Mode::Sync;
+    }
+    return job;
+}
+
+bool ShaderCompiler::isDone(const Job& job) const
+{
+    if (job.done)
+        return true;
+    if (_mode == Mode::Parallel) {
+        GLint done = GL_FALSE;
+        glGetProgramiv(job.program, GL_COMPLETION_STATUS_KHR, &done);
+        return done == GL_TRUE;
+    }
+    return false;
+}
+
+void ShaderCompiler::wait(const Job& job) const
+{
+    // Status queries block until the parallel compile is done
+    if (_mode != Mode::Worker)
+        return;
+    while (!job.done)
+        std::this_thread::yield();
+}
+
+void ShaderCompiler::cancel(const std::shared_ptr<Job>& job)
+{
+    bool done = true;
+    if (_mode == Mode::Worker) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        job->cancelled = true;
+        done = job->done;
+    }
+    // The worker releases jobs it hasn't finished yet
+    if (done)
+        release(*job);
+}
+
+void ShaderCompiler::compile(Job& job) const
+{
+    CpuScope scope("Compile");
+    job.program = glCreateProgram();
+    // Compiled programs are written to the binary cache
+    glProgramParameteri(job.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    if (job.spirv && compileSpirv(job)) {
+        glLinkProgram(job.program);
+        return;
+    }
+
+    for (auto& stage : job.stages) {
+        GLuint shaderID = glCreateShader(stage.first);
+        // Segments are handed over as is, the driver concatenates them
+        const auto& segments = stage.second.segments;
+        std::vector<const GLchar*> strings;
+        std::vector<GLint> lengths;
+        strings.reserve(segments.size());
+        lengths.reserve(segments.size());
+        for (auto& s : segments) {
+            strings.push_back(s.data());
+            lengths.push_back((GLint)s.size());
+        }
+        glShaderSource(shaderID, (GLsizei)segments.size(), strings.data(), lengths.data());
+        glCompileShader(shaderID);
+        glAttachShader(job.program, shaderID);
+        job.shaders.emplace_back(shaderID);
+    }
+    glLinkProgram(job.program);
+}
+
+bool ShaderCompiler::compileSpirv(Job& job) const
+{
+    SpirvCompiler& spirv = SpirvCompiler::instance();
+    SpirvModules modules;
+    auto reflection = std::make_shared<SpirvReflection>();
+    if (!spirv.compile(job.key, job.stages, job.blockBindings, modules, *reflection, job.log)) {
+        job.log += "Falling back to GLSL\n";
+        return false;
+    }
+
+    for (auto& module : modules) {
+        GLuint shaderID = spirv.createShader(module.first, module.second);
+        glAttachShader(job.program, shaderID);
+        job.shaders.emplace_back(shaderID);
+    }
+    job.reflection = reflection;
+    return true;
+}
+
+void ShaderCompiler::release(Job& job) const
+{
+    for (GLuint shader : job.shaders)
+        glDeleteShader(shader);
+    job.shaders.clear();
+    glDeleteProgram(job.program);
+    job.program = 0;
+}
+
+void ShaderCompiler::run(Window::SharedContext context)
+{
+    _window->makeCurrent(context);
+    CpuProfiler::instance().setThreadName("Compiler");
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _cond.wait(lock, [&]{ return !_running || !_queue.empty(); });
+        if (!_running)
+            break;
+
+        auto job = _queue.front();
+        _queue.pop_front();
+        if (job->cancelled)
+            continue;
+
+        lock.unlock();
+        compile(*job);
+        // Make sure the objects are complete before the render thread touches them
+        glFinish();
+        lock.lock();
+
+        if (job->cancelled)
+            release(*job);
+        else
+            job->done = true;
+    }
+
+    // Drop whatever was left in the queue
+    _queue.clear();
+    _window->releaseCurrent(context);
+}
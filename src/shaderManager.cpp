@@ -0,0 +1,98 @@
+#include "shaderManager.hpp"
+
+#include <algorithm>
+
+#include "fileWatcher.hpp"
+#include "log.hpp"
+
+ShaderManager::ShaderManager()
+{ }
+
+#ifdef ROCKET
+Shader& ShaderManager::add(const std::string& name, sync_device* rocket,
+                           const std::string& vertPath, const std::string& fragPath,
+                           const std::string& geomPath)
+{
+    _shaders.emplace_back(name, rocket, vertPath, fragPath, geomPath);
+    rebuildGraph();
+    return _shaders.back();
+}
+#else
+Shader& ShaderManager::add(const std::string& vertPath, const std::string& fragPath,
+                           const std::string& geomPath)
+{
+    _shaders.emplace_back(vertPath, fragPath, geomPath);
+    rebuildGraph();
+    return _shaders.back();
+}
+#endif // ROCKET
+
+void ShaderManager::update()
+{
+    if (FileWatcher::instance().poll(_changedPaths)) {
+        // Collect every program depending on the changes before submitting any
+        std::vector<Shader*> affected;
+        for (auto& path : _changedPaths) {
+            auto dependents = _dependents.find(path);
+            if (dependents == _dependents.end())
+                continue;
+            for (Shader* shader : dependents->second) {
+                if (std::find(affected.begin(), affected.end(), shader) == affected.end())
+                    affected.push_back(shader);
+            }
+        }
+
+        if (!affected.empty()) {
+            // Only a batch starting after the last one finished restarts the measurement,
+            // changes during a reload are added to it and timed from its start
+            if (_reloading.empty())
+                _reloadTime.reset();
+            // Compiles run in parallel until the programs are swapped in
+            for (Shader* shader : affected) {
+                shader->reload();
+                if (std::find(_reloading.begin(), _reloading.end(), shader) == _reloading.end())
+                    _reloading.push_back(shader);
+            }
+            // Includes might have been added or removed
+            rebuildGraph();
+        }
+    }
+
+    for (auto& shader : _shaders)
+        shader.update();
+
+    if (!_reloading.empty()) {
+        bool done = std::none_of(_reloading.begin(), _reloading.end(),
+                                 [](const Shader* s){ return s->pending(); });
+        if (done) {
+            ADD_LOG("[shaders] Reloaded %zu programs in %.1fms\n", _reloading.size(),
+                    _reloadTime.getSeconds() * 1000.f);
+            _reloading.clear();
+        }
+    }
+}
+
+bool ShaderManager::pending() const
+{
+    return std::any_of(_shaders.begin(), _shaders.end(),
+                       [](const Shader& s){ return s.pending(); });
+}
+
+bool ShaderManager::linked() const
+{
+    return std::all_of(_shaders.begin(), _shaders.end(),
+                       [](const Shader& s){ return s.linked(); });
+}
+
+void ShaderManager::rebuildGraph()
+{
+    // Cheap enough to redo from scratch with any realistic number of programs
+    _dependents.clear();
+    for (auto& shader : _shaders) {
+        for (auto& path : shader.sourcePaths()) {
+            auto& dependents = _dependents[path];
+            if (std::find(dependents.begin(), dependents.end(), &shader) == dependents.end())
+                dependents.push_back(&shader);
+        }
+    }
+}
@@ -0,0 +1,746 @@
+#include "shaderMinifier.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "log.hpp"
+
+namespace {
+    enum class Kind {
+        Ident,
+        Number,
+        Punct,
+        // Preprocessor directive, kept verbatim on its own line
+        Line
+    };
+
+    struct Token {
+        Kind kind;
+        size_t begin;
+        size_t end;
+    };
+
+    // Top level function definition or prototype, or const declaration
+    struct Decl {
+        std::string_view name;
+        // Inclusive token range
+        size_t first;
+        size_t last;
+        bool function;
+    };
+
+    const std::unordered_set<std::string_view> TYPES = {
+        "void", "bool", "int", "uint", "float", "double",
+        "vec2", "vec3", "vec4", "dvec2", "dvec3", "dvec4", "bvec2", "bvec3", "bvec4",
+        "ivec2", "ivec3", "ivec4", "uvec2", "uvec3", "uvec4",
+        "mat2", "mat3", "mat4", "mat2x2", "mat2x3", "mat2x4", "mat3x2", "mat3x3", "mat3x4",
+        "mat4x2", "mat4x3", "mat4x4", "dmat2", "dmat3", "dmat4", "dmat2x2", "dmat2x3",
+        "dmat2x4", "dmat3x2", "dmat3x3", "dmat3x4", "dmat4x2", "dmat4x3", "dmat4x4"
+    };
+
+    const std::unordered_set<std::string_view> KEYWORDS = {
+        "attribute", "const", "uniform", "varying", "buffer", "shared", "coherent",
+        "volatile", "restrict", "readonly", "writeonly", "atomic_uint", "layout", "centroid",
+        "flat", "smooth", "noperspective", "patch", "sample", "break", "continue", "do", "for",
+        "while", "switch", "case", "default", "if", "else", "subroutine", "in", "out", "inout",
+        "true", "false", "invariant", "precise", "discard", "return", "lowp", "mediump",
+        "highp", "precision", "struct", "common", "partition", "active", "asm", "class",
+        "union", "enum", "typedef", "template", "this", "resource", "goto", "inline",
+        "noinline", "public", "static", "extern", "external", "interface", "long", "short",
+        "half", "fixed", "unsigned", "superp", "input", "output", "filter", "sizeof", "cast",
+        "namespace", "using"
+    };
+
+    // Renaming a local or an overload with one of these would shadow the builtin
+    const std::unordered_set<std::string_view> BUILTINS = {
+        "radians", "degrees", "sin", "cos", "tan", "asin", "acos", "atan", "sinh", "cosh",
+        "tanh", "asinh", "acosh", "atanh", "pow", "exp", "log", "exp2", "log2", "sqrt",
+        "inversesqrt", "abs", "sign", "floor", "trunc", "round", "roundEven", "ceil", "fract",
+        "mod", "modf", "min", "max", "clamp", "mix", "step", "smoothstep", "isnan", "isinf",
+        "floatBitsToInt", "floatBitsToUint", "intBitsToFloat", "uintBitsToFloat", "fma",
+        "frexp", "ldexp", "packUnorm2x16", "packSnorm2x16", "packUnorm4x8", "packSnorm4x8",
+        "unpackUnorm2x16", "unpackSnorm2x16", "unpackUnorm4x8", "unpackSnorm4x8",
+        "packHalf2x16", "unpackHalf2x16", "packDouble2x32", "unpackDouble2x32", "length",
+        "distance", "dot", "cross", "normalize", "faceforward", "reflect", "refract",
+        "matrixCompMult", "outerProduct", "transpose", "determinant", "inverse", "lessThan",
+        "lessThanEqual", "greaterThan", "greaterThanEqual", "equal", "notEqual", "any", "all",
+        "not", "uaddCarry", "usubBorrow", "umulExtended", "imulExtended", "bitfieldExtract",
+        "bitfieldInsert", "bitfieldReverse", "bitCount", "findLSB", "findMSB", "textureSize",
+        "textureQueryLod", "textureQueryLevels", "textureSamples", "texture", "textureProj",
+        "textureLod", "textureOffset", "texelFetch", "texelFetchOffset", "textureProjOffset",
+        "textureLodOffset", "textureProjLod", "textureProjLodOffset", "textureGrad",
+        "textureGradOffset", "textureProjGrad", "textureProjGradOffset", "textureGather",
+        "textureGatherOffset", "textureGatherOffsets", "atomicCounterIncrement",
+        "atomicCounterDecrement", "atomicCounter", "atomicAdd", "atomicMin", "atomicMax",
+        "atomicAnd", "atomicOr", "atomicXor", "atomicExchange", "atomicCompSwap", "imageSize",
+        "imageSamples", "imageLoad", "imageStore", "imageAtomicAdd", "imageAtomicMin",
+        "imageAtomicMax", "imageAtomicAnd", "imageAtomicOr", "imageAtomicXor",
+        "imageAtomicExchange", "imageAtomicCompSwap", "dFdx", "dFdy", "dFdxFine", "dFdyFine",
+        "dFdxCoarse", "dFdyCoarse", "fwidth", "fwidthFine", "fwidthCoarse",
+        "interpolateAtCentroid", "interpolateAtSample", "interpolateAtOffset", "noise1",
+        "noise2", "noise3", "noise4", "EmitStreamVertex", "EndStreamPrimitive", "EmitVertex",
+        "EndPrimitive", "barrier", "memoryBarrier", "memoryBarrierAtomicCounter",
+        "memoryBarrierBuffer", "memoryBarrierShared", "memoryBarrierImage",
+        "groupMemoryBarrier"
+    };
+
+    // Globals with these are matched by name against the api or other stages
+    const std::unordered_set<std::string_view> STORAGE_QUALIFIERS = {
+        "uniform", "in", "out", "inout", "attribute", "varying", "buffer", "shared", "patch"
+    };
+
+    bool isIdentStart(char c) {
+        return isalpha((unsigned char)c) || c == '_';
+    }
+
+    bool isIdentChar(char c) {
+        return isalnum((unsigned char)c) || c == '_';
+    }
+
+    bool isType(std::string_view name) {
+        return TYPES.count(name) > 0 || name.find("sampler") != std::string_view::npos ||
+               name.compare(0, 5, "image") == 0;
+    }
+
+    std::vector<Token> tokenize(std::string_view text) {
+        std::vector<Token> tokens;
+        bool lineStart = true;
+        size_t i = 0;
+        while (i < text.size()) {
+            char c = text[i];
+            if (c == '\n') {
+                lineStart = true;
+                ++i;
+            } else if (isspace((unsigned char)c)) {
+                ++i;
+            } else if (text.compare(i, 2, "//") == 0) {
+                i = std::min(text.find('\n', i), text.size());
+            } else if (text.compare(i, 2, "/*") == 0) {
+                size_t end = text.find("*/", i + 2);
+                end = end == std::string_view::npos ? text.size() : end + 2;
+                if (text.substr(i, end - i).find('\n') != std::string_view::npos)
+                    lineStart = true;
+                i = end;
+            } else if (c == '#' && lineStart) {
+                // Directives continue over escaped newlines
+                size_t end = i;
+                while (true) {
+                    end = std::min(text.find('\n', end), text.size());
+                    size_t last = end;
+                    while (last > i && text[last - 1] == '\r')
+                        --last;
+                    if (end == text.size() || text[last - 1] != '\\')
+                        break;
+                    ++end;
+                }
+                tokens.push_back({Kind::Line, i, end});
+                lineStart = false;
+                i = end;
+            } else if (isIdentStart(c)) {
+                size_t end = i + 1;
+                while (end < text.size() && isIdentChar(text[end]))
+                    ++end;
+                tokens.push_back({Kind::Ident, i, end});
+                lineStart = false;
+                i = end;
+            } else if (isdigit((unsigned char)c) ||
+                       (c == '.' && i + 1 < text.size() && isdigit((unsigned char)text[i + 1]))) {
+                bool hex = text.compare(i, 2, "0x") == 0 || text.compare(i, 2, "0X") == 0;
+                size_t end = i + 1;
+                while (end < text.size()) {
+                    char n = text[end];
+                    bool exponentSign = !hex && (n == '+' || n == '-') &&
+                                        (text[end - 1] == 'e' || text[end - 1] == 'E');
+                    if (!isIdentChar(n) && n != '.' && !exponentSign)
+                        break;
+                    ++end;
+                }
+                tokens.push_back({Kind::Number, i, end});
+                lineStart = false;
+                i = end;
+            } else {
+                tokens.push_back({Kind::Punct, i, i + 1});
+                lineStart = false;
+                ++i;
+            }
+        }
+        return tokens;
+    }
+
+    template<typename F>
+    void forEachIdent(std::string_view line, F f) {
+        for (size_t i = 0; i < line.size();) {
+            if (!isIdentStart(line[i]) || (i > 0 && isIdentChar(line[i - 1]))) {
+                ++i;
+                continue;
+            }
+            size_t end = i + 1;
+            while (end < line.size() && isIdentChar(line[end]))
+                ++end;
+            f(line.substr(i, end - i));
+            i = end;
+        }
+    }
+
+    // Bijective base 52 so every name is used
+    std::string shortName(size_t n) {
+        const char* ALPHABET = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+        std::string name;
+        for (++n; n > 0; n /= 52) {
+            --n;
+            name.insert(name.begin(), ALPHABET[n % 52]);
+        }
+        return name;
+    }
+
+    // Origins of increasing offsets into the flattened source
+    class OriginCursor {
+    public:
+        OriginCursor(const ShaderSource& source) :
+            _source(source),
+            _segment(0),
+            _segStart(0),
+            _pos(0),
+            _origin(source.origins.front())
+        { }
+
+        ShaderSource::Origin at(size_t offset) {
+            const auto& segments = _source.segments;
+            while (_segment + 1 < segments.size() &&
+                   offset >= _segStart + segments[_segment].size()) {
+                _segStart += segments[_segment].size();
+                ++_segment;
+                _pos = 0;
+                _origin = _source.origins[_segment];
+            }
+            std::string_view segment = segments[_segment];
+            size_t local = std::min(offset - _segStart, segment.size());
+            if (_origin.file >= 0)
+                _origin.line += (uint32_t)std::count(segment.begin() + _pos,
+                                                     segment.begin() + local, '\n');
+            _pos = local;
+            return _origin;
+        }
+
+    private:
+        const ShaderSource&     _source;
+        size_t                  _segment;
+        size_t                  _segStart;
+        size_t                  _pos;
+        ShaderSource::Origin    _origin;
+
+    };
+
+    class Parser {
+    public:
+        Parser(std::string_view text) :
+            _text(text),
+            _tokens(tokenize(text))
+        { }
+
+        std::string_view str(size_t i) const {
+            return _text.substr(_tokens[i].begin, _tokens[i].end - _tokens[i].begin);
+        }
+
+        bool isPunct(size_t i, char c) const {
+            return _tokens[i].kind == Kind::Punct && _text[_tokens[i].begin] == c;
+        }
+
+        bool afterDot(size_t i) const {
+            return i > 0 && isPunct(i - 1, '.');
+        }
+
+        // Finds top level declarations and names that have to keep their spelling
+        // Returns false if braces don't balance
+        bool parse() {
+            size_t depth = 0;
+            size_t stmt = 0;
+            bool inFunction = false;
+            std::string_view functionName;
+            for (size_t i = 0; i < _tokens.size(); ++i) {
+                const Token& t = _tokens[i];
+                if (t.kind == Kind::Line) {
+                    if (depth == 0 && stmt == i)
+                        stmt = i + 1;
+                    continue;
+                }
+                if (t.kind == Kind::Ident && depth > 0 && !inFunction) {
+                    // Struct and block members are accessed after a dot
+                    _fixed.insert(str(i));
+                    continue;
+                }
+                if (t.kind != Kind::Punct)
+                    continue;
+
+                char c = _text[t.begin];
+                if (c == '{') {
+                    if (depth == 0) {
+                        inFunction = function(stmt, i, functionName);
+                        if (!inFunction)
+                            fixQualified(stmt, i);
+                    }
+                    ++depth;
+                } else if (c == '}') {
+                    if (depth == 0)
+                        return false;
+                    --depth;
+                    if (depth == 0 && inFunction) {
+                        _decls.push_back({functionName, stmt, i, true});
+                        inFunction = false;
+                        stmt = i + 1;
+                    }
+                } else if (c == ';' && depth == 0) {
+                    std::string_view name;
+                    if (function(stmt, i, name))
+                        _decls.push_back({name, stmt, i, true});
+                    else if (constant(stmt, i, name))
+                        _decls.push_back({name, stmt, i, false});
+                    else
+                        fixQualified(stmt, i);
+                    stmt = i + 1;
+                }
+            }
+            return depth == 0;
+        }
+
+        // Marks declarations main can't reach
+        void strip() {
+            _live.assign(_decls.size(), false);
+            std::vector<std::vector<std::string_view>> edges(_decls.size());
+            std::vector<std::string_view> pending{"main"};
+            size_t d = 0;
+            for (size_t i = 0; i < _tokens.size(); ++i) {
+                while (d < _decls.size() && _decls[d].last < i)
+                    ++d;
+                bool inDecl = d < _decls.size() && _decls[d].first <= i;
+                if (_tokens[i].kind == Kind::Line)
+                    forEachIdent(str(i), [&](std::string_view name){ pending.push_back(name); });
+                else if (_tokens[i].kind == Kind::Ident && !afterDot(i))
+                    (inDecl ? edges[d] : pending).push_back(str(i));
+            }
+
+            std::unordered_map<std::string_view, std::vector<size_t>> byName;
+            for (size_t i = 0; i < _decls.size(); ++i) {
+                byName[_decls[i].name].push_back(i);
+                if (!strippable(_decls[i])) {
+                    _live[i] = true;
+                    pending.insert(pending.end(), edges[i].begin(), edges[i].end());
+                }
+            }
+
+            std::unordered_set<std::string_view> visited;
+            while (!pending.empty()) {
+                std::string_view name = pending.back();
+                pending.pop_back();
+                if (!visited.insert(name).second)
+                    continue;
+                auto decls = byName.find(name);
+                if (decls == byName.end())
+                    continue;
+                // Overloads and prototypes share the name
+                for (size_t i : decls->second) {
+                    if (_live[i])
+                        continue;
+                    _live[i] = true;
+                    pending.insert(pending.end(), edges[i].begin(), edges[i].end());
+                }
+            }
+        }
+
+        void keepAll() {
+            _live.assign(_decls.size(), true);
+        }
+
+        void count(ShaderMinifier::Stats& stats) const {
+            std::unordered_map<std::string_view, bool> functions;
+            std::unordered_map<std::string_view, bool> constants;
+            for (size_t i = 0; i < _decls.size(); ++i) {
+                auto& names = _decls[i].function ? functions : constants;
+                names[_decls[i].name] |= _live[i];
+            }
+            stats.functions = functions.size();
+            stats.constants = constants.size();
+            for (auto& f : functions)
+                stats.strippedFunctions += f.second ? 0 : 1;
+            for (auto& c : constants)
+                stats.strippedConstants += c.second ? 0 : 1;
+        }
+
+        // Character ranges of the stripped declarations
+        std::vector<std::pair<size_t, size_t>> strippedRanges() const {
+            std::vector<std::pair<size_t, size_t>> ranges;
+            for (size_t i = 0; i < _decls.size(); ++i) {
+                if (!_live[i])
+                    ranges.emplace_back(_tokens[_decls[i].first].begin,
+                                        _tokens[_decls[i].last].end);
+            }
+            return ranges;
+        }
+
+        // Renames what isn't matched by name outside the stage and prints the
+        // remaining tokens with as little whitespace as they need
+        // Fills where each output line starts in the original text
+        std::string minify(std::vector<size_t>& lineOffsets) {
+            // Stripped code is gone so its names are free to use
+            std::vector<bool> kept(_tokens.size(), true);
+            for (size_t i = 0; i < _decls.size(); ++i) {
+                if (!_live[i])
+                    std::fill(kept.begin() + _decls[i].first, kept.begin() + _decls[i].last + 1,
+                              false);
+            }
+
+            // Struct and block bodies are followed by a semicolon or an instance name
+            std::vector<bool> bodyEnd(_tokens.size(), false);
+            for (auto& decl : _decls) {
+                if (decl.function && isPunct(decl.last, '}'))
+                    bodyEnd[decl.last] = true;
+            }
+
+            std::unordered_set<std::string_view> used;
+            std::unordered_set<std::string_view> structs;
+            for (size_t i = 0; i < _tokens.size(); ++i) {
+                if (!kept[i])
+                    continue;
+                if (_tokens[i].kind == Kind::Line) {
+                    forEachIdent(str(i), [&](std::string_view name) {
+                        used.insert(name);
+                        _fixed.insert(name);
+                    });
+                } else if (_tokens[i].kind == Kind::Ident) {
+                    used.insert(str(i));
+                    if (afterDot(i))
+                        _fixed.insert(str(i));
+                    if (i > 0 && str(i - 1) == "struct")
+                        structs.insert(str(i));
+                }
+            }
+
+            std::unordered_map<std::string_view, size_t> candidates;
+            for (size_t i = 0; i < _decls.size(); ++i) {
+                if (_live[i])
+                    candidates[_decls[i].name] = 0;
+            }
+            for (size_t i = 1; i + 1 < _tokens.size(); ++i) {
+                // Locals and parameters are "<type> <name>" followed by one of these
+                if (!kept[i] || _tokens[i].kind != Kind::Ident || _tokens[i - 1].kind != Kind::Ident ||
+                    _tokens[i + 1].kind != Kind::Punct ||
+                    std::string_view("=;,)[").find(_text[_tokens[i + 1].begin]) ==
+                        std::string_view::npos)
+                    continue;
+                std::string_view type = str(i - 1);
+                if (isType(type) || structs.count(type) > 0)
+                    candidates[str(i)] = 0;
+            }
+            for (size_t i = 0; i < _tokens.size(); ++i) {
+                if (!kept[i] || _tokens[i].kind != Kind::Ident || afterDot(i))
+                    continue;
+                auto candidate = candidates.find(str(i));
+                if (candidate != candidates.end())
+                    ++candidate->second;
+            }
+
+            // Most used get the shortest names, ties by name to keep the output stable
+            std::vector<std::pair<std::string_view, size_t>> order;
+            for (auto& c : candidates) {
+                if (_fixed.count(c.first) == 0 && BUILTINS.count(c.first) == 0 &&
+                    KEYWORDS.count(c.first) == 0 && !isType(c.first) && c.first != "main" &&
+                    c.first.compare(0, 3, "gl_") != 0)
+                    order.push_back(c);
+            }
+            std::sort(order.begin(), order.end(), [](auto& a, auto& b) {
+                return a.second != b.second ? a.second > b.second : a.first < b.first;
+            });
+            std::unordered_map<std::string_view, std::string> renames;
+            size_t next = 0;
+            for (auto& o : order) {
+                std::string name;
+                do {
+                    name = shortName(next++);
+                } while (used.count(name) > 0 || KEYWORDS.count(name) > 0 || isType(name));
+                if (name.size() < o.first.size())
+                    renames[o.first] = name;
+            }
+
+            std::string out;
+            out.reserve(_text.size() / 2);
+            size_t depth = 0;
+            const Token* prev = nullptr;
+            for (size_t i = 0; i < _tokens.size(); ++i) {
+                if (!kept[i])
+                    continue;
+
+                const Token& t = _tokens[i];
+                if (t.kind == Kind::Line && !out.empty() && out.back() != '\n')
+                    out += '\n';
+                if (out.empty() || out.back() == '\n')
+                    lineOffsets.push_back(t.begin);
+                if (t.kind == Kind::Line) {
+                    out += str(i);
+                    out += '\n';
+                    prev = nullptr;
+                    continue;
+                }
+
+                std::string_view text = str(i);
+                if (t.kind == Kind::Ident && !afterDot(i)) {
+                    auto rename = renames.find(text);
+                    if (rename != renames.end())
+                        text = rename->second;
+                }
+                // Operators like "- -" can't be glued together
+                bool word = t.kind != Kind::Punct;
+                if (prev != nullptr) {
+                    bool prevWord = prev->kind != Kind::Punct;
+                    bool operators = !word && !prevWord && prev->end != t.begin &&
+                        strchr("+-*/%<>=!&|^", _text[prev->begin]) != nullptr &&
+                        strchr("+-*/%<>=&|^", _text[t.begin]) != nullptr;
+                    if ((word && prevWord) || operators)
+                        out += ' ';
+                }
+                out += text;
+                prev = &t;
+
+                // Top level statements on their own lines keep the output readable
+                if (t.kind == Kind::Punct) {
+                    char c = _text[t.begin];
+                    if (c == '{')
+                        ++depth;
+                    else if (c == '}' && depth > 0)
+                        --depth;
+                    if (depth == 0 && (c == ';' || (c == '}' && bodyEnd[i]))) {
+                        out += '\n';
+                        prev = nullptr;
+                    }
+                }
+            }
+            return out;
+        }
+
+    private:
+        // Tokens in [first, end) are "<type> <name>(<params>)"
+        bool function(size_t first, size_t end, std::string_view& name) const {
+            if (end <= first + 2 || !isPunct(end - 1, ')'))
+                return false;
+            size_t depth = 0;
+            size_t open = end - 1;
+            for (;; --open) {
+                if (isPunct(open, ')'))
+                    ++depth;
+                else if (isPunct(open, '(') && --depth == 0)
+                    break;
+                if (open == first)
+                    return false;
+            }
+            if (open == first || _tokens[open - 1].kind != Kind::Ident ||
+                str(open - 1) == "layout")
+                return false;
+            for (size_t i = first; i < open; ++i) {
+                if (isPunct(i, '=') || _tokens[i].kind == Kind::Line)
+                    return false;
+            }
+            name = str(open - 1);
+            return true;
+        }
+
+        // Tokens in [first, end) are "const <type> <name> = <value>" with a single name
+        bool constant(size_t first, size_t end, std::string_view& name) const {
+            if (str(first) != "const")
+                return false;
+            size_t assign = 0;
+            int depth = 0;
+            for (size_t i = first; i < end; ++i) {
+                if (isPunct(i, '(') || isPunct(i, '['))
+                    ++depth;
+                else if (isPunct(i, ')') || isPunct(i, ']'))
+                    --depth;
+                else if (depth == 0 && isPunct(i, ','))
+                    return false;
+                else if (depth == 0 && assign == 0 && isPunct(i, '='))
+                    assign = i;
+            }
+            if (assign <= first + 1)
+                return false;
+            size_t nameIndex = assign - 1;
+            // Skip the array size
+            if (isPunct(nameIndex, ']')) {
+                while (nameIndex > first && !isPunct(nameIndex, '['))
+                    --nameIndex;
+                --nameIndex;
+            }
+            if (_tokens[nameIndex].kind != Kind::Ident)
+                return false;
+            name = str(nameIndex);
+            return true;
+        }
+
+        void fixQualified(size_t first, size_t end) {
+            bool qualified = false;
+            int depth = 0;
+            for (size_t i = first; i < end; ++i) {
+                if (isPunct(i, '('))
+                    ++depth;
+                else if (isPunct(i, ')'))
+                    --depth;
+                else if (depth == 0 && _tokens[i].kind == Kind::Ident &&
+                         STORAGE_QUALIFIERS.count(str(i)) > 0)
+                    qualified = true;
+            }
+            if (!qualified)
+                return;
+            for (size_t i = first; i < end; ++i) {
+                if (_tokens[i].kind == Kind::Ident)
+                    _fixed.insert(str(i));
+            }
+        }
+
+        // Conditionals have to be fully inside for the range to be cut out, other
+        // directives like #define affect the code after it
+        bool strippable(const Decl& decl) const {
+            int depth = 0;
+            for (size_t i = decl.first; i <= decl.last; ++i) {
+                if (_tokens[i].kind != Kind::Line)
+                    continue;
+                std::string_view line = str(i);
+                if (line[0] != '#')
+                    return false;
+                size_t start = std::min(line.find_first_not_of(" \t", 1), line.size());
+                size_t end = std::min(line.find_first_not_of(
+                    "abcdefghijklmnopqrstuvwxyz", start), line.size());
+                std::string_view name = line.substr(start, end - start);
+                if (name == "if" || name == "ifdef" || name == "ifndef")
+                    ++depth;
+                else if (name == "endif" && depth > 0)
+                    --depth;
+                else if ((name != "else" && name != "elif") || depth == 0)
+                    return false;
+            }
+            return depth == 0;
+        }
+
+        std::string_view                        _text;
+        std::vector<Token>                      _tokens;
+        std::vector<Decl>                       _decls;
+        std::vector<bool>                       _live;
+        std::unordered_set<std::string_view>    _fixed;
+
+    };
+}
+
+ShaderMinifier& ShaderMinifier::instance()
+{
+    static ShaderMinifier minifier;
+    return minifier;
+}
+
+ShaderMinifier::ShaderMinifier()
+{
+#ifdef NDEBUG
+    _options = {true, true};
+#else
+    _options = {false, false};
+#endif // NDEBUG
+}
+
+void ShaderMinifier::setOptions(const Options& options)
+{
+    _options = options;
+}
+
+const ShaderMinifier::Options& ShaderMinifier::options() const
+{
+    return _options;
+}
+
+bool ShaderMinifier::enabled() const
+{
+    return _options.strip || _options.minify;
+}
+
+ShaderMinifier::Stats ShaderMinifier::process(ShaderSource& source) const
+{
+    Stats stats;
+    stats.bytesBefore = source.length();
+    stats.bytesAfter = stats.bytesBefore;
+    if (!enabled() || source.empty())
+        return stats;
+
+    // Declarations can span segments so they are parsed from a flat copy
+    std::string text;
+    text.reserve(stats.bytesBefore);
+    for (auto& s : source.segments)
+        text.append(s);
+
+    Parser parser(text);
+    if (!parser.parse()) {
+        ADD_LOG("[minify] Braces don't balance, leaving source as is\n");
+        return stats;
+    }
+    if (_options.strip)
+        parser.strip();
+    else
+        parser.keepAll();
+    parser.count(stats);
+
+    OriginCursor cursor(source);
+    std::vector<std::string_view> segments;
+    std::vector<ShaderSource::Origin> origins;
+    if (_options.minify) {
+        // Every line gets the origin of its first token
+        std::vector<size_t> lineOffsets;
+        source.strings.emplace_back(parser.minify(lineOffsets));
+        std::string_view minified = source.strings.back();
+        size_t lineStart = 0;
+        for (size_t offset : lineOffsets) {
+            size_t lineEnd = std::min(minified.find('\n', lineStart), minified.size() - 1) + 1;
+            segments.push_back(minified.substr(lineStart, lineEnd - lineStart));
+            origins.push_back(cursor.at(offset));
+            lineStart = lineEnd;
+        }
+    } else {
+        // Stripped code leaves its newlines behind to keep the line count
+        auto ranges = parser.strippedRanges();
+        size_t maxLines = 0;
+        for (auto& r : ranges)
+            maxLines = std::max(maxLines, (size_t)std::count(text.begin() + r.first,
+                                                             text.begin() + r.second, '\n'));
+        source.strings.emplace_back(maxLines, '\n');
+        std::string_view newlines = source.strings.back();
+
+        auto range = ranges.begin();
+        size_t offset = 0;
+        for (auto& segment : source.segments) {
+            size_t segEnd = offset + segment.size();
+            for (size_t pos = offset; pos < segEnd;) {
+                while (range != ranges.end() && range->second <= pos)
+                    ++range;
+                if (range == ranges.end() || range->first >= segEnd) {
+                    segments.push_back(segment.substr(pos - offset));
+                    origins.push_back(cursor.at(pos));
+                    break;
+                }
+                if (range->first > pos) {
+                    segments.push_back(segment.substr(pos - offset, range->first - pos));
+                    origins.push_back(cursor.at(pos));
+                    pos = range->first;
+                }
+                size_t cut = std::min(range->second, segEnd);
+                size_t lines = std::count(text.begin() + pos, text.begin() + cut, '\n');
+                if (lines > 0) {
+                    segments.push_back(newlines.substr(0, lines));
+                    origins.push_back(cursor.at(pos));
+                }
+                pos = cut;
+            }
+            offset = segEnd;
+        }
+    }
+    source.segments = std::move(segments);
+    source.origins = std::move(origins);
+    stats.bytesAfter = source.length();
+    return stats;
+}
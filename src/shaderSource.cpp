@@ -0,0 +1,161 @@
+#include "shaderSource.hpp"
+
+#include <algorithm>
+
+namespace {
+    ShaderSource::Origin advance(ShaderSource::Origin origin, std::string_view text) {
+        // Generated text doesn't have lines to map to
+        if (origin.file >= 0)
+            origin.line += (uint32_t)std::count(text.begin(), text.end(), '\n');
+        return origin;
+    }
+
+    // True if line is the directive, possibly with space after the #
+    bool isDirective(std::string_view line, std::string_view name) {
+        if (line.empty() || line[0] != '#')
+            return false;
+        size_t start = std::min(line.find_first_not_of(" \t", 1), line.size());
+        return line.compare(start, name.size(), name) == 0;
+    }
+}
+
+size_t ShaderSource::length() const
+{
+    size_t length = 0;
+    for (auto& s : segments)
+        length += s.size();
+    return length;
+}
+
+int32_t ShaderSource::pathIndex(const std::string& path)
+{
+    auto existing = std::find(paths.begin(), paths.end(), path);
+    if (existing != paths.end())
+        return (int32_t)(existing - paths.begin());
+    paths.push_back(path);
+    return (int32_t)paths.size() - 1;
+}
+
+void ShaderSource::push(std::string_view segment, Origin origin)
+{
+    segments.push_back(segment);
+    origins.push_back(origin);
+}
+
+void ShaderSource::append(std::string&& str, Origin origin)
+{
+    strings.emplace_back(std::move(str));
+    push(strings.back(), origin);
+}
+
+size_t ShaderSource::lineCount() const
+{
+    size_t count = 0;
+    for (auto& s : segments)
+        count += std::count(s.begin(), s.end(), '\n');
+    return count;
+}
+
+void ShaderSource::insertAfterVersion(std::string&& str, Origin origin)
+{
+    for (size_t i = 0; i < segments.size(); ++i) {
+        size_t version = segments[i].find("#version");
+        if (version == std::string_view::npos)
+            continue;
+        std::string_view segment = segments[i];
+        size_t lineEnd = std::min(segment.find('\n', version), segment.size() - 1) + 1;
+        insert(i, lineEnd, std::move(str), origin);
+        return;
+    }
+    insert(0, 0, std::move(str), origin);
+}
+
+void ShaderSource::insertAfterExtensions(std::string&& str, Origin origin)
+{
+    // Directives and comments may come before the extensions, anything else ends them
+    size_t index = 0;
+    size_t offset = 0;
+    bool inComment = false;
+    for (size_t i = 0; i < segments.size(); ++i) {
+        std::string_view segment = segments[i];
+        for (size_t lineStart = 0; lineStart < segment.size();) {
+            size_t lineEnd = std::min(segment.find('\n', lineStart), segment.size() - 1) + 1;
+            std::string_view line = segment.substr(lineStart, lineEnd - lineStart);
+            line.remove_prefix(std::min(line.find_first_not_of(" \t\r\n"), line.size()));
+            lineStart = lineEnd;
+            if (inComment) {
+                inComment = line.find("*/") == std::string_view::npos;
+            } else if (line.compare(0, 2, "/*") == 0) {
+                inComment = line.find("*/", 2) == std::string_view::npos;
+            } else if (isDirective(line, "version") || isDirective(line, "extension")) {
+                index = i;
+                offset = lineEnd;
+            } else if (!line.empty() && line[0] != '#' && line.compare(0, 2, "//") != 0) {
+                insert(index, offset, std::move(str), origin);
+                return;
+            }
+        }
+    }
+    insert(index, offset, std::move(str), origin);
+}
+
+void ShaderSource::insert(size_t index, size_t offset, std::string&& str, Origin origin)
+{
+    strings.emplace_back(std::move(str));
+    if (index < segments.size() && offset > 0) {
+        // Split the segment at offset
+        std::string_view segment = segments[index];
+        segments[index] = segment.substr(0, offset);
+        ++index;
+        if (offset < segment.size()) {
+            segments.insert(segments.begin() + index, segment.substr(offset));
+            origins.insert(origins.begin() + index,
+                           advance(origins[index - 1], segments[index - 1]));
+        }
+    }
+    segments.insert(segments.begin() + index, strings.back());
+    origins.insert(origins.begin() + index, origin);
+}
+
+size_t ShaderSource::replaceLines(
+    const std::function<bool(std::string_view line, std::string& replacement)>& replace)
+{
+    // Segments always hold whole lines so a line never spans two
+    size_t replaced = 0;
+    std::vector<std::string_view> newSegments;
+    std::vector<Origin> newOrigins;
+    for (size_t i = 0; i < segments.size(); ++i) {
+        std::string_view segment = segments[i];
+        Origin segOrigin = origins[i];
+        Origin lineOrigin = origins[i];
+        size_t segStart = 0;
+        for (size_t lineStart = 0; lineStart < segment.size();) {
+            size_t lineEnd = std::min(segment.find('\n', lineStart), segment.size());
+            std::string replacement;
+            if (replace(segment.substr(lineStart, lineEnd - lineStart), replacement)) {
+                if (lineStart > segStart) {
+                    newSegments.push_back(segment.substr(segStart, lineStart - segStart));
+                    newOrigins.push_back(segOrigin);
+                }
+                // Newline might be in the next segment if the file didn't end with one
+                if (lineEnd < segment.size())
+                    replacement += '\n';
+                strings.emplace_back(std::move(replacement));
+                newSegments.emplace_back(strings.back());
+                newOrigins.push_back(lineOrigin);
+                segStart = lineEnd + 1;
+                segOrigin = advance(lineOrigin, "\n");
+                ++replaced;
+            }
+            lineStart = lineEnd + 1;
+            lineOrigin = advance(lineOrigin, "\n");
+        }
+        if (segStart < segment.size()) {
+            newSegments.push_back(segment.substr(segStart));
+            newOrigins.push_back(segOrigin);
+        }
+    }
+    segments = std::move(newSegments);
+    origins = std::move(newOrigins);
+    return replaced;
+}
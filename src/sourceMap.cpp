@@ -0,0 +1,103 @@
+#include "sourceMap.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+
+namespace {
+    // Finds "S:L" or "S(L)" at the start of the message or after a severity like
+    // "ERROR: ", begin and end cover the line number
+    bool parseReference(const std::string& msg, uint32_t& string, uint32_t& line,
+                        size_t& begin, size_t& end) {
+        size_t pos = 0;
+        while (pos < msg.size() && isalpha((unsigned char)msg[pos]))
+            ++pos;
+        if (pos > 0 && msg.compare(pos, 2, ": ") == 0)
+            pos += 2;
+        else
+            pos = 0;
+
+        auto number = [&](size_t& i, uint32_t& value) {
+            size_t start = i;
+            value = 0;
+            while (i < msg.size() && isdigit((unsigned char)msg[i]))
+                value = value * 10 + (msg[i++] - '0');
+            return i > start;
+        };
+        if (!number(pos, string) || pos >= msg.size())
+            return false;
+        char open = msg[pos];
+        if (open != ':' && open != '(')
+            return false;
+        begin = ++pos;
+        if (!number(pos, line))
+            return false;
+        end = pos;
+        return open == ':' || (pos < msg.size() && msg[pos] == ')');
+    }
+}
+
+SourceMap::SourceMap(const ShaderSource& source) :
+    _paths(source.paths)
+{
+    uint32_t line = 0;
+    for (size_t i = 0; i < source.segments.size(); ++i) {
+        std::string_view segment = source.segments[i];
+        const ShaderSource::Origin& origin = source.origins[i];
+        _stringLines.push_back(line);
+        if (segment.empty())
+            continue;
+
+        // Consecutive segments of a file only need one run
+        bool continues = !_runs.empty() && _runs.back().file == origin.file &&
+                         (origin.file < 0 ||
+                          _runs.back().fileLine + (line - _runs.back().line) == origin.line);
+        if (!continues)
+            _runs.push_back({line, origin.file, origin.line});
+        line += (uint32_t)std::count(segment.begin(), segment.end(), '\n');
+    }
+}
+
+bool SourceMap::lookup(uint32_t string, uint32_t line, Location& location) const
+{
+    if (line == 0)
+        return false;
+    // Drivers that concatenate the strings report everything in string 0
+    uint32_t target = line - 1;
+    if (string > 0 && string < _stringLines.size())
+        target += _stringLines[string];
+
+    auto run = std::upper_bound(_runs.begin(), _runs.end(), target,
+                                [](uint32_t l, const Run& r){ return l < r.line; });
+    if (run == _runs.begin())
+        return false;
+    --run;
+    if (run->file < 0)
+        return false;
+    location.path = &_paths[run->file];
+    location.line = run->fileLine + (target - run->line) + 1;
+    return true;
+}
+
+std::string SourceMap::remap(const std::string& log) const
+{
+    std::string remapped;
+    const std::string* lastPath = nullptr;
+    std::istringstream stream(log);
+    for (std::string msg; std::getline(stream, msg);) {
+        uint32_t string, line;
+        size_t begin, end;
+        Location location;
+        if (parseReference(msg, string, line, begin, end) && lookup(string, line, location)) {
+            // Print the file if it changed from last error
+            if (location.path != lastPath) {
+                remapped += "In file '" + *location.path + "'\n";
+                lastPath = location.path;
+            }
+            msg.replace(begin, end - begin, std::to_string(location.line));
+        }
+        remapped += msg;
+        remapped += '\n';
+    }
+    return remapped;
+}
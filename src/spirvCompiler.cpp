@@ -0,0 +1,422 @@
+#include "spirvCompiler.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+#ifdef SKUNKWORK_SPIRV
+#include <glslang/Public/ResourceLimits.h>
+#include <glslang/Public/ShaderLang.h>
+#include <glslang/SPIRV/GlslangToSpv.h>
+#include <spirv-tools/optimizer.hpp>
+#endif // SKUNKWORK_SPIRV
+
+#include "fileSystem.hpp"
+#include "glExtensions.hpp"
+#include "log.hpp"
+#include "sourceMap.hpp"
+
+#ifndef GL_SHADER_BINARY_FORMAT_SPIR_V
+#define GL_SHADER_BINARY_FORMAT_SPIR_V 0x9551
+#endif // GL_SHADER_BINARY_FORMAT_SPIR_V
+
+namespace {
+    const char MAGIC[4] = {'S', 'K', 'S', 'V'};
+
+#ifdef SKUNKWORK_SPIRV
+    // Parts of the SPIR-V spec needed for reflection
+    const uint32_t SPV_MAGIC = 0x07230203;
+    const size_t SPV_HEADER_WORDS = 5;
+    const uint32_t OP_NAME = 5;
+    const uint32_t OP_MEMBER_NAME = 6;
+    const uint32_t OP_TYPE_FLOAT = 22;
+    const uint32_t OP_TYPE_VECTOR = 23;
+    const uint32_t OP_TYPE_STRUCT = 30;
+    const uint32_t OP_TYPE_POINTER = 32;
+    const uint32_t OP_VARIABLE = 59;
+    const uint32_t OP_DECORATE = 71;
+    const uint32_t OP_MEMBER_DECORATE = 72;
+    const uint32_t DECORATION_LOCATION = 30;
+    const uint32_t DECORATION_BINDING = 33;
+    const uint32_t DECORATION_OFFSET = 35;
+    const uint32_t STORAGE_UNIFORM_CONSTANT = 0;
+    const uint32_t STORAGE_UNIFORM = 2;
+
+    // Ids of one module relevant to the uniform interface
+    struct ModuleInfo {
+        std::unordered_map<uint32_t, std::string> names;
+        std::unordered_map<uint32_t, std::vector<std::string>> memberNames;
+        std::unordered_map<uint32_t, std::vector<GLint>> memberOffsets;
+        std::unordered_map<uint32_t, GLint> locations;
+        // Variable -> index of the binding literal
+        std::unordered_map<uint32_t, size_t> bindingWords;
+        std::unordered_map<uint32_t, GLenum> types;
+        std::unordered_map<uint32_t, std::vector<uint32_t>> structs;
+        std::unordered_map<uint32_t, uint32_t> pointees;
+        // Variable id, pointer type and storage class
+        std::vector<std::array<uint32_t, 3>> variables;
+    };
+
+    std::string literalString(const uint32_t* words, size_t count) {
+        const char* str = (const char*)words;
+        return std::string(str, strnlen(str, count * sizeof(uint32_t)));
+    }
+
+    bool scan(const std::vector<uint32_t>& words, ModuleInfo& info) {
+        if (words.size() < SPV_HEADER_WORDS || words[0] != SPV_MAGIC)
+            return false;
+
+        for (size_t i = SPV_HEADER_WORDS; i < words.size();) {
+            uint32_t count = words[i] >> 16;
+            uint32_t op = words[i] & 0xFFFF;
+            if (count == 0 || i + count > words.size())
+                return false;
+            const uint32_t* w = &words[i];
+
+            switch (op) {
+            case OP_NAME:
+                info.names[w[1]] = literalString(w + 2, count - 2);
+                break;
+            case OP_MEMBER_NAME: {
+                auto& names = info.memberNames[w[1]];
+                names.resize(std::max<size_t>(names.size(), w[2] + 1));
+                names[w[2]] = literalString(w + 3, count - 3);
+                break;
+            }
+            case OP_TYPE_FLOAT:
+                if (w[2] == 32)
+                    info.types[w[1]] = GL_FLOAT;
+                break;
+            case OP_TYPE_VECTOR:
+                if (info.types[w[2]] == GL_FLOAT && w[3] >= 2 && w[3] <= 4) {
+                    const GLenum vecTypes[] = {GL_FLOAT_VEC2, GL_FLOAT_VEC3, GL_FLOAT_VEC4};
+                    info.types[w[1]] = vecTypes[w[3] - 2];
+                }
+                break;
+            case OP_TYPE_STRUCT:
+                info.structs[w[1]] = std::vector<uint32_t>(w + 2, w + count);
+                break;
+            case OP_TYPE_POINTER:
+                info.pointees[w[1]] = w[3];
+                break;
+            case OP_VARIABLE:
+                info.variables.push_back({w[2], w[1], w[3]});
+                break;
+            case OP_DECORATE:
+                if (w[2] == DECORATION_LOCATION)
+                    info.locations[w[1]] = w[3];
+                else if (w[2] == DECORATION_BINDING)
+                    info.bindingWords[w[1]] = i + 3;
+                break;
+            case OP_MEMBER_DECORATE:
+                if (w[3] == DECORATION_OFFSET) {
+                    auto& offsets = info.memberOffsets[w[1]];
+                    offsets.resize(std::max<size_t>(offsets.size(), w[2] + 1), -1);
+                    offsets[w[2]] = w[4];
+                }
+                break;
+            default:
+                break;
+            }
+            i += count;
+        }
+        return true;
+    }
+
+    GLint typeSize(GLenum type) {
+        switch (type) {
+        case GL_FLOAT:
+            return 4;
+        case GL_FLOAT_VEC2:
+            return 8;
+        case GL_FLOAT_VEC3:
+            return 12;
+        default:
+            return 16;
+        }
+    }
+
+    // Adds the module's interface to reflection and rewrites the block bindings
+    // glslang assigned to the ones expected by the uniform buffers
+    void reflect(std::vector<uint32_t>& words, const ModuleInfo& info,
+                 const std::map<std::string, GLuint>& blockBindings,
+                 SpirvReflection& reflection) {
+        for (auto& variable : info.variables) {
+            uint32_t id = variable[0];
+            auto pointee = info.pointees.find(variable[1]);
+            if (pointee == info.pointees.end())
+                continue;
+            uint32_t typeID = pointee->second;
+
+            if (variable[2] == STORAGE_UNIFORM_CONSTANT) {
+                auto name = info.names.find(id);
+                auto location = info.locations.find(id);
+                if (name == info.names.end() || location == info.locations.end())
+                    continue;
+                // Stages share locations for the same uniform
+                bool known = std::any_of(reflection.uniforms.begin(), reflection.uniforms.end(),
+                                         [&](const SpirvReflection::Uniform& u) {
+                                             return u.name == name->second;
+                                         });
+                if (known)
+                    continue;
+                auto type = info.types.find(typeID);
+                reflection.uniforms.push_back({name->second,
+                                               type != info.types.end() ? type->second : 0,
+                                               location->second});
+            } else if (variable[2] == STORAGE_UNIFORM) {
+                // Block name is the name of its type
+                auto name = info.names.find(typeID);
+                auto members = info.structs.find(typeID);
+                if (name == info.names.end() || members == info.structs.end())
+                    continue;
+
+                auto desired = blockBindings.find(name->second);
+                auto bindingWord = info.bindingWords.find(id);
+                if (desired != blockBindings.end() && bindingWord != info.bindingWords.end())
+                    words[bindingWord->second] = desired->second;
+
+                bool known = std::any_of(reflection.blocks.begin(), reflection.blocks.end(),
+                                         [&](const SpirvReflection::Block& b) {
+                                             return b.name == name->second;
+                                         });
+                if (known)
+                    continue;
+
+                SpirvReflection::Block block{name->second, 0, {}};
+                auto memberNames = info.memberNames.find(typeID);
+                auto memberOffsets = info.memberOffsets.find(typeID);
+                for (size_t m = 0; m < members->second.size(); ++m) {
+                    if (memberNames == info.memberNames.end() ||
+                        memberOffsets == info.memberOffsets.end() ||
+                        m >= memberNames->second.size() || m >= memberOffsets->second.size())
+                        break;
+                    auto type = info.types.find(members->second[m]);
+                    GLenum glType = type != info.types.end() ? type->second : 0;
+                    GLint offset = memberOffsets->second[m];
+                    block.members.push_back({memberNames->second[m], glType, offset});
+                    block.size = std::max(block.size, offset + typeSize(glType));
+                }
+                // std140 blocks are padded to a vec4
+                block.size = (block.size + 15) / 16 * 16;
+                reflection.blocks.push_back(block);
+            }
+        }
+    }
+
+    EShLanguage toLanguage(GLenum stage) {
+        switch (stage) {
+        case GL_VERTEX_SHADER:
+            return EShLangVertex;
+        case GL_GEOMETRY_SHADER:
+            return EShLangGeometry;
+        default:
+            return EShLangFragment;
+        }
+    }
+#endif // SKUNKWORK_SPIRV
+}
+
+SpirvCompiler& SpirvCompiler::instance()
+{
+    static SpirvCompiler compiler;
+    return compiler;
+}
+
+SpirvCompiler::SpirvCompiler() :
+    _supported(false),
+    _specializeShader(nullptr)
+{ }
+
+void SpirvCompiler::init()
+{
+#ifdef SKUNKWORK_SPIRV
+    const char* specializeFunc = nullptr;
+    if (hasGLVersion(4, 6))
+        specializeFunc = "glSpecializeShader";
+    else if (hasGLExtension("GL_ARB_gl_spirv"))
+        specializeFunc = "glSpecializeShaderARB";
+    if (specializeFunc != nullptr)
+        _specializeShader = (PFNSPECIALIZESHADER)gl3wGetProcAddress(specializeFunc);
+    if (_specializeShader == nullptr) {
+        ADD_LOG("[spirv] Context can't load SPIR-V, using GLSL\n");
+        return;
+    }
+
+    glslang::InitializeProcess();
+    // Modules are cached even when the driver can't store program binaries
+    makeDir(CACHE_DIRECTORY);
+    _supported = true;
+    ADD_LOG("[spirv] Compiling shaders to SPIR-V\n");
+#endif // SKUNKWORK_SPIRV
+}
+
+void SpirvCompiler::destroy()
+{
+#ifdef SKUNKWORK_SPIRV
+    if (_supported)
+        glslang::FinalizeProcess();
+#endif // SKUNKWORK_SPIRV
+    _supported = false;
+}
+
+bool SpirvCompiler::supported() const
+{
+    return _supported;
+}
+
+bool SpirvCompiler::compile(uint64_t key,
+                            const std::vector<std::pair<GLenum, ShaderSource>>& stages,
+                            const std::map<std::string, GLuint>& blockBindings,
+                            SpirvModules& modules, SpirvReflection& reflection,
+                            std::string& log) const
+{
+#ifdef SKUNKWORK_SPIRV
+    // Cached modules skip glslang and the optimizer completely
+    if (!load(key, modules)) {
+        EShMessages messages = (EShMessages)(EShMsgSpvRules | EShMsgDefault);
+        std::vector<std::unique_ptr<glslang::TShader>> shaders;
+        glslang::TProgram program;
+        for (auto& stage : stages) {
+            EShLanguage language = toLanguage(stage.first);
+            auto shader = std::make_unique<glslang::TShader>(language);
+
+            // Segments are handed over as is like with the driver
+            const auto& segments = stage.second.segments;
+            std::vector<const char*> strings;
+            std::vector<int> lengths;
+            for (auto& s : segments) {
+                strings.push_back(s.data());
+                lengths.push_back((int)s.size());
+            }
+            shader->setStringsWithLengths(strings.data(), lengths.data(), (int)strings.size());
+            shader->setEnvInput(glslang::EShSourceGlsl, language, glslang::EShClientOpenGL, 100);
+            shader->setEnvClient(glslang::EShClientOpenGL, glslang::EShTargetOpenGL_450);
+            shader->setEnvTarget(glslang::EShTargetSpv, glslang::EShTargetSpv_1_0);
+            // GL SPIR-V needs explicit locations and bindings, blocks are rebound later
+            shader->setAutoMapLocations(true);
+            shader->setAutoMapBindings(true);
+            if (!shader->parse(GetDefaultResources(), 410, false, messages)) {
+                log += SourceMap(stage.second).remap(shader->getInfoLog());
+                return false;
+            }
+            program.addShader(shader.get());
+            shaders.emplace_back(std::move(shader));
+        }
+        if (!program.link(messages) || !program.mapIO()) {
+            log += program.getInfoLog();
+            return false;
+        }
+
+        spvtools::Optimizer optimizer(SPV_ENV_OPENGL_4_5);
+        optimizer.RegisterPerformancePasses();
+        for (auto& stage : stages) {
+            std::vector<uint32_t> words;
+            glslang::GlslangToSpv(*program.getIntermediate(toLanguage(stage.first)), words);
+            std::vector<uint32_t> optimized;
+            if (optimizer.Run(words.data(), words.size(), &optimized))
+                words = std::move(optimized);
+            else
+                log += "spirv-opt failed, using unoptimized module\n";
+            modules.emplace_back(stage.first, std::move(words));
+        }
+        store(key, modules);
+    }
+
+    for (auto& module : modules) {
+        ModuleInfo info;
+        if (!scan(module.second, info)) {
+            log += "Malformed SPIR-V module\n";
+            return false;
+        }
+        reflect(module.second, info, blockBindings, reflection);
+    }
+    return true;
+#else
+    (void) key;
+    (void) stages;
+    (void) blockBindings;
+    (void) modules;
+    (void) reflection;
+    log += "Built without SPIR-V support\n";
+    return false;
+#endif // SKUNKWORK_SPIRV
+}
+
+GLuint SpirvCompiler::createShader(GLenum stage, const std::vector<uint32_t>& words) const
+{
+    GLuint shaderID = glCreateShader(stage);
+    glShaderBinary(1, &shaderID, GL_SHADER_BINARY_FORMAT_SPIR_V, words.data(),
+                   (GLsizei)(words.size() * sizeof(uint32_t)));
+    _specializeShader(shaderID, "main", 0, nullptr, nullptr);
+    return shaderID;
+}
+
+bool SpirvCompiler::load(uint64_t key, SpirvModules& modules) const
+{
+    std::ifstream file(path(key), std::ios::binary | std::ios::ate);
+    std::streamoff remaining = file ? (std::streamoff)file.tellg() : 0;
+    char magic[4];
+    uint32_t count = 0;
+    if (!file || !file.seekg(0) || !file.read(magic, sizeof(magic)) ||
+        memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || !file.read((char*)&count, sizeof(count)))
+        return false;
+    remaining -= sizeof(magic) + sizeof(count);
+
+    SpirvModules loaded;
+    for (uint32_t i = 0; i < count; ++i) {
+        GLenum stage;
+        uint32_t length;
+        if (!file.read((char*)&stage, sizeof(stage)) || !file.read((char*)&length, sizeof(length)))
+            return false;
+        remaining -= sizeof(stage) + sizeof(length);
+        // Don't trust the length of a damaged file with the allocation
+        if ((std::streamoff)length * (std::streamoff)sizeof(uint32_t) > remaining)
+            return false;
+        std::vector<uint32_t> words(length);
+        if (!file.read((char*)words.data(), length * sizeof(uint32_t)))
+            return false;
+        remaining -= length * sizeof(uint32_t);
+        loaded.emplace_back(stage, std::move(words));
+    }
+    modules = std::move(loaded);
+    return true;
+}
+
+void SpirvCompiler::store(uint64_t key, const SpirvModules& modules) const
+{
+    // Written unpatched since block bindings are applied on every load
+    // Other processes may be loading the same entry so it's renamed into place once complete
+    std::string finalPath = path(key);
+    std::string writePath = tempPath(finalPath);
+    {
+        std::ofstream file(writePath, std::ios::binary | std::ios::trunc);
+        if (!file)
+            return;
+        uint32_t count = (uint32_t)modules.size();
+        file.write(MAGIC, sizeof(MAGIC));
+        file.write((const char*)&count, sizeof(count));
+        for (auto& module : modules) {
+            uint32_t length = (uint32_t)module.second.size();
+            file.write((const char*)&module.first, sizeof(module.first));
+            file.write((const char*)&length, sizeof(length));
+            file.write((const char*)module.second.data(), length * sizeof(uint32_t));
+        }
+        file.close();
+        if (!file) {
+            remove(writePath.c_str());
+            return;
+        }
+    }
+    replaceFile(writePath, finalPath);
+}
+
+std::string SpirvCompiler::path(uint64_t key) const
+{
+    char name[21];
+    snprintf(name, sizeof(name), "%016" PRIx64 ".spv", key);
+    return std::string(CACHE_DIRECTORY) + name;
+}
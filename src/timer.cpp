@@ -1,17 +1,23 @@
 #include "timer.hpp"
 
 Timer::Timer() :
-    _start(std::chrono::system_clock::now())
+    _start(std::chrono::steady_clock::now())
 {}
 
 void Timer::reset()
 {
-    _start = std::chrono::system_clock::now();
+    _start = std::chrono::steady_clock::now();
 }
 
 float Timer::getSeconds() const
 {
-    auto end = std::chrono::system_clock::now();
+    auto end = std::chrono::steady_clock::now();
     std::chrono::duration<float> dt = end - _start;
     return dt.count();
 }
+
+uint64_t Timer::getNanoseconds() const
+{
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - _start).count();
+}
@@ -0,0 +1,176 @@
+#include "traceRecorder.hpp"
+
+#include <cstdio>
+#include <ctime>
+
+#include "cpuProfiler.hpp"
+#include "fileSystem.hpp"
+#include "log.hpp"
+
+namespace {
+    const uint32_t CPU_PID = 0;
+    const uint32_t GPU_PID = 1;
+
+    std::string escape(const std::string& str) {
+        std::string escaped;
+        for (char c : str) {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            if ((unsigned char)c >= 0x20)
+                escaped += c;
+        }
+        return escaped;
+    }
+
+    void appendMetadata(std::string& out, const char* type, uint32_t pid, uint32_t tid,
+                        const std::string& name) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), ",\n{\"name\":\"%s\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,",
+                 type, pid, tid);
+        out += buf;
+        out += "\"args\":{\"name\":\"" + escape(name) + "\"}}";
+    }
+}
+
+TraceRecorder& TraceRecorder::instance()
+{
+    static TraceRecorder recorder;
+    return recorder;
+}
+
+TraceRecorder::TraceRecorder() :
+    _recording(false),
+    _eventCount(0),
+    _stopping(false),
+    _firstEvent(true)
+{ }
+
+void TraceRecorder::start()
+{
+    if (_recording)
+        return;
+
+    makeDir(TRACE_DIRECTORY);
+    char name[64];
+    time_t now = time(nullptr);
+    strftime(name, sizeof(name), "trace_%Y%m%d_%H%M%S.json", localtime(&now));
+    _path = std::string(TRACE_DIRECTORY) + name;
+    _file.open(_path, std::ios_base::out | std::ios_base::trunc);
+    if (!_file) {
+        ADD_LOG("[trace] Failed to open '%s'\n", _path.c_str());
+        return;
+    }
+    _file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+    _recording = true;
+    _eventCount = 0;
+    _chunk.reserve(CHUNK_SIZE);
+    _stopping = false;
+    _firstEvent = true;
+    _writer = std::thread(&TraceRecorder::run, this);
+    ADD_LOG("[trace] Recording to '%s'\n", _path.c_str());
+}
+
+void TraceRecorder::stop()
+{
+    if (!_recording)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_chunk.empty())
+            _chunks.emplace_back(std::move(_chunk));
+        _stopping = true;
+    }
+    _chunk = std::vector<Event>();
+    _cond.notify_one();
+    _writer.join();
+
+    // Writer is done so the file is ours again
+    std::string out;
+    const char* firstSeparator = _firstEvent ? "" : ",\n";
+    appendMetadata(out, "process_name", CPU_PID, 0, "CPU");
+    appendMetadata(out, "process_name", GPU_PID, 0, "GPU");
+    const CpuProfiler& cpuProfiler = CpuProfiler::instance();
+    for (uint32_t i = 0; i < cpuProfiler.threadCount(); ++i)
+        appendMetadata(out, "thread_name", CPU_PID, i, cpuProfiler.threadName(i));
+    _file << firstSeparator << out.substr(2) << "\n]}\n";
+    _file.close();
+
+    _recording = false;
+    ADD_LOG("[trace] Wrote %zu events to '%s'\n", _eventCount, _path.c_str());
+}
+
+void TraceRecorder::toggle()
+{
+    if (_recording)
+        stop();
+    else
+        start();
+}
+
+bool TraceRecorder::recording() const
+{
+    return _recording;
+}
+
+void TraceRecorder::addCpu(uint32_t thread, const char* name, uint64_t start, uint64_t end)
+{
+    add({name, false, thread, start, end, true});
+}
+
+void TraceRecorder::addGpu(const std::string& name, uint64_t start, uint64_t end,
+                           bool calibrated)
+{
+    add({name, true, 0, start, end, calibrated});
+}
+
+void TraceRecorder::add(Event&& event)
+{
+    if (!_recording)
+        return;
+    _chunk.emplace_back(std::move(event));
+    ++_eventCount;
+    if (_chunk.size() < CHUNK_SIZE)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _chunks.emplace_back(std::move(_chunk));
+    }
+    _cond.notify_one();
+    _chunk = std::vector<Event>();
+    _chunk.reserve(CHUNK_SIZE);
+}
+
+void TraceRecorder::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _cond.wait(lock, [&]{ return _stopping || !_chunks.empty(); });
+        if (_chunks.empty())
+            break;
+
+        std::vector<Event> chunk = std::move(_chunks.front());
+        _chunks.pop_front();
+        lock.unlock();
+
+        std::string out;
+        char buf[128];
+        for (const Event& e : chunk) {
+            out += _firstEvent ? "" : ",\n";
+            _firstEvent = false;
+            out += "{\"name\":\"" + escape(e.name) + "\",\"ph\":\"X\",";
+            snprintf(buf, sizeof(buf), "\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+                     e.gpu ? GPU_PID : CPU_PID, e.thread, e.start * 0.001,
+                     (e.end - e.start) * 0.001);
+            out += buf;
+            if (!e.calibrated)
+                out += ",\"args\":{\"approximate\":true}";
+            out += "}";
+        }
+        _file << out;
+
+        lock.lock();
+    }
+}
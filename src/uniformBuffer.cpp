@@ -0,0 +1,255 @@
+#include "uniformBuffer.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "glExtensions.hpp"
+#include "log.hpp"
+
+namespace {
+    const GLuint64 FENCE_TIMEOUT_NS = 1000000000;
+
+    bool toUniformType(GLenum glType, UniformType& type) {
+        switch (glType) {
+        case GL_FLOAT:
+            type = UniformType::Float;
+            return true;
+        case GL_FLOAT_VEC2:
+            type = UniformType::Vec2;
+            return true;
+        case GL_FLOAT_VEC3:
+            type = UniformType::Vec3;
+            return true;
+        default:
+            return false;
+        }
+    }
+}
+
+UniformBuffer::UniformBuffer(const std::string& blockName, GLuint binding, uint32_t ringSize) :
+    _blockName(blockName),
+    _binding(binding),
+    _ringSize(ringSize),
+    _bufferID(0),
+    _blockSize(0),
+    _stride(0),
+    _slot(0),
+    _mapped(nullptr),
+    _dirty(false)
+{ }
+
+UniformBuffer::~UniformBuffer()
+{
+    release();
+}
+
+bool UniformBuffer::reflect(GLuint program)
+{
+    GLuint index = glGetUniformBlockIndex(program, _blockName.c_str());
+    if (index == GL_INVALID_INDEX)
+        return false;
+    glUniformBlockBinding(program, index, _binding);
+
+    GLint size = 0;
+    GLint count = 0;
+    glGetActiveUniformBlockiv(program, index, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+    glGetActiveUniformBlockiv(program, index, GL_UNIFORM_BLOCK_ACTIVE_UNIFORMS, &count);
+    std::vector<GLint> indices(count);
+    glGetActiveUniformBlockiv(program, index, GL_UNIFORM_BLOCK_ACTIVE_UNIFORM_INDICES,
+                              indices.data());
+
+    std::vector<GLuint> uniformIndices(indices.begin(), indices.end());
+    std::vector<GLint> offsets(count);
+    std::vector<GLint> types(count);
+    glGetActiveUniformsiv(program, count, uniformIndices.data(), GL_UNIFORM_OFFSET, offsets.data());
+    glGetActiveUniformsiv(program, count, uniformIndices.data(), GL_UNIFORM_TYPE, types.data());
+
+    std::vector<Member> layout;
+    for (GLint i = 0; i < count; ++i) {
+        char name[64];
+        glGetActiveUniformName(program, uniformIndices[i], sizeof(name), NULL, name);
+        UniformType type;
+        if (!toUniformType(types[i], type)) {
+            ADD_LOG("[ubo] Unsupported type %d for '%s' in '%s'\n", types[i], name,
+                    _blockName.c_str());
+            continue;
+        }
+        layout.push_back({name, type, offsets[i]});
+    }
+    setLayout(size, std::move(layout));
+    return true;
+}
+
+void UniformBuffer::reflect(const SpirvReflection::Block& block)
+{
+    std::vector<Member> layout;
+    for (auto& m : block.members) {
+        UniformType type;
+        if (!toUniformType(m.type, type)) {
+            ADD_LOG("[ubo] Unsupported type %d for '%s' in '%s'\n", m.type, m.name.c_str(),
+                    _blockName.c_str());
+            continue;
+        }
+        layout.push_back({m.name, type, m.location});
+    }
+    setLayout(block.size, std::move(layout));
+}
+
+GLint UniformBuffer::offset(const std::string& name, UniformType type) const
+{
+    for (auto& m : _layout) {
+        if (m.name == name)
+            return m.type == type ? m.offset : -1;
+    }
+    return -1;
+}
+
+void UniformBuffer::write(GLint offset, const void* data, size_t size)
+{
+    if (offset < 0 || (size_t)offset + size > _staging.size())
+        return;
+    if (memcmp(_staging.data() + offset, data, size) != 0) {
+        memcpy(_staging.data() + offset, data, size);
+        _dirty = true;
+    }
+}
+
+void UniformBuffer::upload()
+{
+    if (_bufferID == 0)
+        return;
+
+    // Other buffers might use the same binding so it always needs to be set
+    if (!_dirty) {
+        glBindBufferRange(GL_UNIFORM_BUFFER, _binding, _bufferID, _slot * _stride, _blockSize);
+        UniformStats::addSkipped();
+        return;
+    }
+
+    GLintptr offset = 0;
+    if (_mapped != nullptr) {
+        // Everything issued so far might read the current range
+        if (_fences[_slot] != nullptr)
+            glDeleteSync(_fences[_slot]);
+        _fences[_slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        _slot = (_slot + 1) % _ringSize;
+        offset = _slot * _stride;
+        // The ring is long enough for this to be signaled in practice
+        if (_fences[_slot] != nullptr) {
+            glClientWaitSync(_fences[_slot], GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT_NS);
+            glDeleteSync(_fences[_slot]);
+            _fences[_slot] = nullptr;
+        }
+        memcpy(_mapped + offset, _staging.data(), _blockSize);
+    } else {
+        _slot = (_slot + 1) % _ringSize;
+        offset = _slot * _stride;
+        glBindBuffer(GL_UNIFORM_BUFFER, _bufferID);
+        glBufferSubData(GL_UNIFORM_BUFFER, offset, _blockSize, _staging.data());
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    glBindBufferRange(GL_UNIFORM_BUFFER, _binding, _bufferID, offset, _blockSize);
+    _dirty = false;
+    UniformStats::addUploaded();
+}
+
+const std::string& UniformBuffer::blockName() const
+{
+    return _blockName;
+}
+
+GLuint UniformBuffer::binding() const
+{
+    return _binding;
+}
+
+void UniformBuffer::setLayout(GLint size, std::vector<Member>&& layout)
+{
+    std::sort(layout.begin(), layout.end(),
+              [](const Member& a, const Member& b){ return a.offset < b.offset; });
+
+    // Programs sharing the block have the same std140 layout
+    bool sameLayout = size == _blockSize && layout.size() == _layout.size() &&
+        std::equal(layout.begin(), layout.end(), _layout.begin(),
+                   [](const Member& a, const Member& b) {
+                       return a.name == b.name && a.type == b.type && a.offset == b.offset;
+                   });
+    if (sameLayout && _bufferID != 0)
+        return;
+
+    if (_bufferID != 0)
+        ADD_LOG("[ubo] Layout of '%s' changed\n", _blockName.c_str());
+    _blockSize = size;
+    _layout = std::move(layout);
+    allocate();
+    for (auto& slot : _memberSlots)
+        resolveSlot(slot);
+}
+
+const GLint* UniformBuffer::memberSlot(const std::string& name, UniformType type)
+{
+    auto slot = std::find_if(_memberSlots.begin(), _memberSlots.end(),
+                             [&](const Member& m){ return m.name == name; });
+    if (slot != _memberSlots.end()) {
+        if (slot->type != type) {
+            ADD_LOG("[ubo] Member '%s' requested with different types\n", name.c_str());
+            return nullptr;
+        }
+        return &slot->offset;
+    }
+
+    _memberSlots.push_back({name, type, -1});
+    resolveSlot(_memberSlots.back());
+    return &_memberSlots.back().offset;
+}
+
+void UniformBuffer::resolveSlot(Member& slot) const
+{
+    slot.offset = offset(slot.name, slot.type);
+    if (slot.offset == -1 && _bufferID != 0)
+        ADD_LOG("[ubo] '%s' has no member '%s' of matching type\n", _blockName.c_str(),
+                slot.name.c_str());
+}
+
+void UniformBuffer::allocate()
+{
+    release();
+
+    GLint alignment = 1;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    _stride = (_blockSize + alignment - 1) / alignment * alignment;
+    _staging.assign(_blockSize, 0);
+    _fences.assign(_ringSize, nullptr);
+    _slot = 0;
+    _dirty = true;
+
+    GLsizeiptr size = (GLsizeiptr)_stride * _ringSize;
+    glGenBuffers(1, &_bufferID);
+    glBindBuffer(GL_UNIFORM_BUFFER, _bufferID);
+    if (hasGLVersion(4, 4) || hasGLExtension("GL_ARB_buffer_storage")) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_UNIFORM_BUFFER, size, nullptr, flags);
+        _mapped = (uint8_t*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, size, flags);
+    } else {
+        glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void UniformBuffer::release()
+{
+    for (GLsync fence : _fences) {
+        if (fence != nullptr)
+            glDeleteSync(fence);
+    }
+    _fences.clear();
+    if (_mapped != nullptr) {
+        glBindBuffer(GL_UNIFORM_BUFFER, _bufferID);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        _mapped = nullptr;
+    }
+    glDeleteBuffers(1, &_bufferID);
+    _bufferID = 0;
+}
@@ -4,11 +4,41 @@
 #include <imgui_impl_glfw.h>
 #include <stdio.h>
 
-bool Window::init(int w, int h, const std::string& title)
+#include "cpuProfiler.hpp"
+#include "log.hpp"
+#include "traceRecorder.hpp"
+
+bool Window::SharedContext::valid() const
+{
+    return window != nullptr || headless.context != nullptr;
+}
+
+Window::Window() :
+    _window(nullptr),
+    _w(0),
+    _h(0),
+    _cursorX(0.f),
+    _cursorY(0.f),
+    _drawGUI(false),
+    _frame(0),
+    _frameLimit(0),
+    _closed(false)
+{ }
+
+bool Window::init(const Config& config, const std::string& title)
 {
-    _w = w;
-    _h = h;
-    _drawGUI = true;
+    _w = config.width;
+    _h = config.height;
+    _cursorX = 0.f;
+    _cursorY = 0.f;
+    _frame = 0;
+    _frameLimit = config.frames;
+    _closed = false;
+    // There's no input to toggle the GUI with when headless
+    _drawGUI = !config.headless;
+    if (config.headless)
+        return initHeadless();
+
     // Init GLFW-context
     glfwSetErrorCallback(errorCallback);
     if (!glfwInit())
@@ -56,8 +86,48 @@ bool Window::init(int w, int h, const std::string& title)
     return true;
 }
 
+bool Window::initHeadless()
+{
+    if (!_headless.init(4, 1))
+        return false;
+
+    // gl3w loads through libGL, glvnd dispatches the calls to the current EGL context
+    gl3wInit();
+    GLenum err = glGetError();
+    if (err != GL_NO_ERROR) {
+        _headless.destroy();
+        fprintf(stderr, "Error initializing GL!\n");
+        fprintf(stderr, "Code: %d\n", err);
+        return false;
+    }
+
+    // Everything that would go to the window is drawn here instead
+    _target = std::make_unique<FrameBuffer>(
+        _w, _h,
+        std::vector<TextureParams>({{GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_NEAREST,
+                                     GL_NEAREST, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE}}),
+        GL_DEPTH_COMPONENT24, GL_DEPTH_ATTACHMENT
+    );
+    FrameBuffer::setDefault(_target.get());
+    FrameBuffer::bindDefault();
+    glViewport(0, 0, _w, _h);
+    glClearColor(0.f, 0.f, 0.f, 1.f);
+
+    // The log window isn't drawn
+    Log::instance().setEcho(true);
+    ADD_LOG("[window] Headless %dx%d, %s context\n", _w, _h,
+            _headless.surfaceless() ? "surfaceless" : "pbuffer");
+    return true;
+}
+
 void Window::destroy()
 {
+    if (_window == nullptr) {
+        FrameBuffer::setDefault(nullptr);
+        _target.reset();
+        _headless.destroy();
+        return;
+    }
     glfwDestroyWindow(_window);
     glfwTerminate();
 }
@@ -66,16 +136,46 @@ Window::Window(Window&& other) :
     _window(other._window),
     _w(other._w),
     _h(other._h),
-    _drawGUI(other._drawGUI)
+    _cursorX(other._cursorX),
+    _cursorY(other._cursorY),
+    _drawGUI(other._drawGUI),
+    _frame(other._frame),
+    _frameLimit(other._frameLimit),
+    _closed(other._closed),
+    _headless(std::move(other._headless)),
+    _target(std::move(other._target))
 {
     other._window = nullptr;
 }
 
 bool Window::open() const
 {
+    if (_frameLimit > 0 && _frame >= _frameLimit)
+        return false;
+    if (_window == nullptr)
+        return !_closed;
     return !glfwWindowShouldClose(_window);
 }
 
+void Window::close()
+{
+    if (_window == nullptr)
+        _closed = true;
+    else
+        glfwSetWindowShouldClose(_window, GLFW_TRUE);
+}
+
+bool Window::headless() const
+{
+    return _window == nullptr;
+}
+
+void Window::setVsync(bool vsync)
+{
+    if (_window != nullptr)
+        glfwSwapInterval(vsync ? 1 : 0);
+}
+
 GLFWwindow* Window::ptr() const
 {
     return _window;
@@ -91,19 +191,79 @@ int Window::height() const
     return _h;
 }
 
+float Window::cursorX() const
+{
+    return _cursorX;
+}
+
+float Window::cursorY() const
+{
+    return _cursorY;
+}
+
 bool Window::drawGUI() const
 {
     return _drawGUI;
 }
 
+Window::SharedContext Window::createSharedContext() const
+{
+    SharedContext context;
+    if (_window == nullptr) {
+        context.headless = _headless.createShared();
+        return context;
+    }
+    // Context hints are still the ones set in init
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    context.window = glfwCreateWindow(1, 1, "", NULL, _window);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    return context;
+}
+
+void Window::destroySharedContext(SharedContext& context) const
+{
+    if (context.window != nullptr)
+        glfwDestroyWindow(context.window);
+    context.window = nullptr;
+    _headless.destroyShared(context.headless);
+}
+
+void Window::makeCurrent(const SharedContext& context) const
+{
+    if (context.window != nullptr)
+        glfwMakeContextCurrent(context.window);
+    else
+        _headless.makeCurrent(context.headless);
+}
+
+void Window::releaseCurrent(const SharedContext& context) const
+{
+    if (context.window != nullptr)
+        glfwMakeContextCurrent(nullptr);
+    else
+        _headless.releaseCurrent();
+}
+
 void Window::startFrame()
 {
-    glfwPollEvents();
+    CpuScope scope("Events");
+    if (_window != nullptr) {
+        glfwPollEvents();
+        return;
+    }
+    // Code that binds framebuffer 0 would draw nowhere
+    FrameBuffer::bindDefault();
 }
 
-void Window::endFrame() const
+void Window::endFrame()
 {
-    glfwSwapBuffers(_window);
+    // Includes waiting for vsync and for the driver to catch up
+    CpuScope scope("Swap");
+    if (_window == nullptr)
+        glFlush();
+    else
+        glfwSwapBuffers(_window);
+    ++_frame;
 }
 
 void Window::errorCallback(int error, const char* description)
@@ -119,10 +279,16 @@ void Window::framebufferSizeCallback(GLFWwindow* window, int width, int height)
     glViewport(0, 0, width, height);
 }
 
-void Window::cursorCallback(GLFWwindow*, double xpos, double ypos)
+void Window::cursorCallback(GLFWwindow* window, double xpos, double ypos)
 {
-    (void) xpos;
-    (void) ypos;
+    // Cursor is in screen coordinates, which differ from the framebuffer's on high dpi
+    int width, height;
+    glfwGetWindowSize(window, &width, &height);
+    if (width == 0 || height == 0)
+        return;
+    Window* thisPtr = (Window*)glfwGetWindowUserPointer(window);
+    thisPtr->_cursorX = (float)(xpos / width);
+    thisPtr->_cursorY = 1.f - (float)(ypos / height);
 }
 
 void Window::scrollCallback(GLFWwindow* window, double xoffset, double yoffset)
@@ -156,6 +322,9 @@ void Window::keyCallback(GLFWwindow* window, int32_t key, int32_t scancode, int3
             case GLFW_KEY_G:
                 thisPtr->_drawGUI = !thisPtr->_drawGUI;
                 break;
+            case GLFW_KEY_T:
+                TraceRecorder::instance().toggle();
+                break;
             default: 
                 break;
             }